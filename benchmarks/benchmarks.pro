@@ -0,0 +1,15 @@
+QT      -= gui
+QT      += core-private
+CONFIG  += console link_prl
+CONFIG  -= app_bundle
+TEMPLATE = app
+TARGET   = eventdispatcher_benchmark
+SOURCES  = main.cpp
+DESTDIR  = ../bin
+
+LIBS           += -L$$PWD/../lib -leventdispatcher_epoll
+INCLUDEPATH    += $$PWD/../src
+DEPENDPATH     += $$PWD/../src
+PRE_TARGETDEPS += $$PWD/../lib/libeventdispatcher_epoll.a
+
+CONFIG(iouring): DEFINES += EVENTDISPATCHER_IOURING
@@ -0,0 +1,680 @@
+#include <QtCore/QAtomicInt>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QSocketNotifier>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+#include <QtCore/private/qeventdispatcher_unix_p.h>
+
+#if defined(QT_FEATURE_glib)
+#	if QT_FEATURE_glib > 0
+#		define HAVE_GLIB_DISPATCHER
+#	endif
+#elif !defined(QT_NO_GLIB)
+#	define HAVE_GLIB_DISPATCHER
+#endif
+
+#ifdef HAVE_GLIB_DISPATCHER
+#	include <QtCore/private/qeventdispatcher_glib_p.h>
+#endif
+
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <stdio.h>
+#include <unistd.h>
+#include "eventdispatcher_epoll.h"
+#ifdef EVENTDISPATCHER_IOURING
+#	include "eventdispatcher_iouring.h"
+#endif
+
+// Every result is printed as a single JSON object per line:
+// {"dispatcher":"epoll","scenario":"timers","timer_type":"precise","count":1000,"metric":"events_per_sec","value":12345.000}
+
+namespace {
+
+struct Options {
+	int duration;             // milliseconds per measurement
+	bool quick;               // smaller object counts
+	QStringList dispatchers;
+	QStringList scenarios;
+};
+
+struct Context {
+	const Options* options;
+	QByteArray dispatcher;
+	const char* scenario;
+};
+
+typedef void (*ScenarioFunc)(const Context& ctx);
+
+void report(const Context& ctx, const QByteArray& params, const char* metric, double value)
+{
+	printf(
+		"{\"dispatcher\":\"%s\",\"scenario\":\"%s\",%s%s\"metric\":\"%s\",\"value\":%.3f}\n",
+		ctx.dispatcher.constData(), ctx.scenario, params.constData(), params.isEmpty() ? "" : ",", metric, value
+	);
+
+	fflush(stdout);
+}
+
+QAbstractEventDispatcher* createDispatcher(const QByteArray& name)
+{
+	if ("epoll" == name) {
+		return new EventDispatcherEPoll();
+	}
+
+#ifdef EVENTDISPATCHER_IOURING
+	if ("iouring" == name) {
+		return EventDispatcherIOUring::isSupported() ? new EventDispatcherIOUring() : 0;
+	}
+#endif
+
+	if ("unix" == name) {
+		return new QEventDispatcherUNIX();
+	}
+
+#ifdef HAVE_GLIB_DISPATCHER
+	if ("glib" == name) {
+		return new QEventDispatcherGlib();
+	}
+#endif
+
+	return 0;
+}
+
+// Whether the dispatcher can watch a descriptor this large
+bool supportsDescriptor(const QByteArray& dispatcher, int fd)
+{
+#if QT_VERSION < 0x050700
+	// QEventDispatcherUNIX used select() before Qt 5.7
+	return "unix" != dispatcher || fd < FD_SETSIZE;
+#else
+	Q_UNUSED(dispatcher)
+	Q_UNUSED(fd)
+	return true;
+#endif
+}
+
+int raiseDescriptorLimit(void)
+{
+	struct rlimit lim;
+	if (0 == getrlimit(RLIMIT_NOFILE, &lim)) {
+		lim.rlim_cur = lim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &lim);
+		getrlimit(RLIMIT_NOFILE, &lim);
+		return static_cast<int>(qMin(lim.rlim_cur, rlim_t(0x7FFFFFFF)));
+	}
+
+	return 1024;
+}
+
+class Stopper : public QObject {
+public:
+	explicit Stopper(int msec) : fired(false) { this->startTimer(msec, Qt::PreciseTimer); }
+	bool fired;
+
+protected:
+	virtual void timerEvent(QTimerEvent*) { this->fired = true; }
+};
+
+// Runs the event loop of the current thread for msec milliseconds
+void spin(int msec, QEventLoop::ProcessEventsFlags flags = QEventLoop::WaitForMoreEvents)
+{
+	QAbstractEventDispatcher* d = QAbstractEventDispatcher::instance();
+	Stopper stopper(msec);
+	while (!stopper.fired) {
+		d->processEvents(flags);
+	}
+}
+
+double perSecond(quint64 n, qint64 nsec)
+{
+	return nsec > 0 ? double(n) * 1e9 / double(nsec) : 0.0;
+}
+
+QByteArray param(const char* name, int value)
+{
+	return QByteArray("\"") + name + "\":" + QByteArray::number(value);
+}
+
+QByteArray param(const char* name, const char* value)
+{
+	return QByteArray("\"") + name + "\":\"" + value + "\"";
+}
+
+class TimerReceiver : public QObject {
+public:
+	struct Entry {
+		qint64 last;     // microseconds
+		int interval;
+	};
+
+	TimerReceiver(void) : events(0), lateness(0), max_lateness(0) { this->clock.start(); }
+
+	QElapsedTimer clock;
+	QHash<int, Entry> timers;
+	quint64 events;
+	qint64 lateness;
+	qint64 max_lateness;
+
+protected:
+	virtual void timerEvent(QTimerEvent* e)
+	{
+		const qint64 now = this->clock.nsecsElapsed() / 1000;
+		Entry& entry     = this->timers[e->timerId()];
+		const qint64 late = now - entry.last - qint64(entry.interval) * 1000;
+		if (late > 0) {
+			this->lateness += late;
+			this->max_lateness = qMax(this->max_lateness, late);
+		}
+
+		entry.last = now;
+		++this->events;
+	}
+};
+
+void benchmarkTimers(const Context& ctx)
+{
+	static const int counts_full[]  = { 1, 1000, 10000, 100000 };
+	static const int counts_quick[] = { 1, 1000 };
+	static const struct { Qt::TimerType type; const char* name; } types[] = {
+		{ Qt::PreciseTimer,    "precise"     },
+		{ Qt::CoarseTimer,     "coarse"      },
+		{ Qt::VeryCoarseTimer, "very_coarse" }
+	};
+
+	const int* counts = ctx.options->quick ? counts_quick : counts_full;
+	const int n_counts = ctx.options->quick ? 2 : 4;
+
+	for (int t=0; t<3; ++t) {
+		for (int c=0; c<n_counts; ++c) {
+			const int count = counts[c];
+			TimerReceiver receiver;
+			QVector<int> ids;
+			ids.reserve(count);
+
+			// Intervals are spread over 10..1000 ms so that the load grows with the number of timers, not the frequency
+			QElapsedTimer clock;
+			clock.start();
+			for (int i=0; i<count; ++i) {
+				int interval = 10 + (i * 7919) % 991;
+				int id = receiver.startTimer(interval, types[t].type);
+				TimerReceiver::Entry entry = { receiver.clock.nsecsElapsed() / 1000, interval };
+				receiver.timers.insert(id, entry);
+				ids.append(id);
+			}
+
+			const qint64 register_time = clock.nsecsElapsed();
+
+			clock.restart();
+			spin(ctx.options->duration);
+			const qint64 run_time = clock.nsecsElapsed();
+
+			clock.restart();
+			for (int i=0; i<ids.size(); ++i) {
+				receiver.killTimer(ids.at(i));
+			}
+
+			const qint64 unregister_time = clock.nsecsElapsed();
+
+			QByteArray params = param("timer_type", types[t].name) + "," + param("count", count);
+			report(ctx, params, "events_per_sec", perSecond(receiver.events, run_time));
+			report(ctx, params, "mean_lateness_usec", receiver.events ? double(receiver.lateness) / receiver.events : 0.0);
+			report(ctx, params, "max_lateness_usec", receiver.max_lateness);
+			report(ctx, params, "register_nsec_per_timer", double(register_time) / count);
+			report(ctx, params, "unregister_nsec_per_timer", double(unregister_time) / count);
+		}
+	}
+}
+
+class PingNotifier : public QSocketNotifier {
+public:
+	PingNotifier(int fd, int peer, quint64* counter)
+		: QSocketNotifier(fd, QSocketNotifier::Read), m_peer(peer), m_counter(counter)
+	{
+	}
+
+protected:
+	virtual bool event(QEvent* e)
+	{
+		if (QEvent::SockAct == e->type()) {
+			// Bounce the byte back, so that the descriptor becomes readable again
+			char c;
+			if (1 == read(static_cast<int>(this->socket()), &c, 1)) {
+				ssize_t res = write(this->m_peer, &c, 1);
+				Q_UNUSED(res)
+			}
+
+			++*this->m_counter;
+			return true;
+		}
+
+		return QSocketNotifier::event(e);
+	}
+
+private:
+	int m_peer;
+	quint64* m_counter;
+};
+
+struct SocketPairs {
+	QVector<int> fds; // fds[2*i] is watched, fds[2*i + 1] is its peer
+
+	~SocketPairs(void)
+	{
+		for (int i=0; i<this->fds.size(); ++i) {
+			close(this->fds.at(i));
+		}
+	}
+
+	bool create(int count, const QByteArray& dispatcher)
+	{
+		this->fds.reserve(2 * count);
+		for (int i=0; i<count; ++i) {
+			int sv[2];
+			if (-1 == socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv)) {
+				return false;
+			}
+
+			this->fds.append(sv[0]);
+			this->fds.append(sv[1]);
+			if (!supportsDescriptor(dispatcher, sv[0])) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+};
+
+void benchmarkNotifiers(const Context& ctx)
+{
+	static const int counts_full[]  = { 10, 100, 1000, 10000, 100000 };
+	static const int counts_quick[] = { 10, 1000 };
+
+	const int* counts  = ctx.options->quick ? counts_quick : counts_full;
+	const int n_counts = ctx.options->quick ? 2 : 5;
+	const int limit    = raiseDescriptorLimit();
+
+	for (int c=0; c<n_counts; ++c) {
+		const int count  = counts[c];
+		const int active = qMin(count, 64);
+
+		if (2 * count + 64 > limit) {
+			fprintf(stderr, "%s: skipping %d socket pairs, RLIMIT_NOFILE is %d\n", ctx.scenario, count, limit);
+			continue;
+		}
+
+		SocketPairs pairs;
+		if (!pairs.create(count, ctx.dispatcher)) {
+			fprintf(stderr, "%s: cannot create %d socket pairs for the %s dispatcher\n", ctx.scenario, count, ctx.dispatcher.constData());
+			continue;
+		}
+
+		quint64 activations = 0;
+		QVector<PingNotifier*> notifiers;
+		notifiers.reserve(count);
+
+		QElapsedTimer clock;
+		clock.start();
+		for (int i=0; i<count; ++i) {
+			notifiers.append(new PingNotifier(pairs.fds.at(2*i), pairs.fds.at(2*i + 1), &activations));
+		}
+
+		const qint64 register_time = clock.nsecsElapsed();
+
+		// Only a few descriptors are busy, the rest are idle: this is what a server with lots of idle connections looks like
+		for (int i=0; i<active; ++i) {
+			ssize_t res = write(pairs.fds.at(2*i + 1), "x", 1);
+			Q_UNUSED(res)
+		}
+
+		clock.restart();
+		spin(ctx.options->duration, QEventLoop::AllEvents);
+		const qint64 run_time = clock.nsecsElapsed();
+
+		clock.restart();
+		qDeleteAll(notifiers);
+		const qint64 unregister_time = clock.nsecsElapsed();
+
+		QByteArray params = param("count", count) + "," + param("active", active);
+		report(ctx, params, "activations_per_sec", perSecond(activations, run_time));
+		report(ctx, params, "register_nsec_per_notifier", double(register_time) / count);
+		report(ctx, params, "unregister_nsec_per_notifier", double(unregister_time) / count);
+	}
+}
+
+struct WakeUpState {
+	QAbstractEventDispatcher* dispatcher;
+	QElapsedTimer clock;
+	QAtomicInt ping;
+	QAtomicInt pong;
+	QAtomicInt stop;
+	qint64 sent_at;   // written before ping is released
+	int iterations;   // latency measurements to take
+	quint64 calls;    // throughput: wakeUp() calls made
+	bool throughput;
+};
+
+class WakeUpSender : public QThread {
+public:
+	explicit WakeUpSender(WakeUpState* state) : m_state(state) {}
+
+protected:
+	virtual void run(void)
+	{
+		WakeUpState* s = this->m_state;
+		if (s->throughput) {
+			while (!s->stop.loadAcquire()) {
+				s->dispatcher->wakeUp();
+				++s->calls;
+			}
+
+			return;
+		}
+
+		for (int i=0; i<s->iterations; ++i) {
+			// Give the event loop some time to block
+			usleep(50);
+			s->sent_at = s->clock.nsecsElapsed();
+			s->ping.storeRelease(1);
+			s->dispatcher->wakeUp();
+
+			while (!s->pong.fetchAndStoreAcquire(0)) {
+				QThread::yieldCurrentThread();
+			}
+		}
+
+		s->stop.storeRelease(1);
+		s->dispatcher->wakeUp();
+	}
+
+private:
+	WakeUpState* m_state;
+};
+
+void benchmarkWakeUp(const Context& ctx)
+{
+	QAbstractEventDispatcher* d = QAbstractEventDispatcher::instance();
+
+	{
+		WakeUpState state;
+		state.dispatcher = d;
+		state.sent_at    = 0;
+		state.iterations = ctx.options->quick ? 1000 : 10000;
+		state.calls      = 0;
+		state.throughput = false;
+		state.clock.start();
+
+		QVector<qint64> latencies;
+		latencies.reserve(state.iterations);
+
+		WakeUpSender sender(&state);
+		sender.start();
+		while (!state.stop.loadAcquire()) {
+			d->processEvents(QEventLoop::WaitForMoreEvents);
+			if (state.ping.fetchAndStoreAcquire(0)) {
+				latencies.append(state.clock.nsecsElapsed() - state.sent_at);
+				state.pong.storeRelease(1);
+			}
+		}
+
+		sender.wait();
+
+		std::sort(latencies.begin(), latencies.end());
+		if (!latencies.isEmpty()) {
+			qint64 sum = 0;
+			for (int i=0; i<latencies.size(); ++i) {
+				sum += latencies.at(i);
+			}
+
+			QByteArray params = param("mode", "latency");
+			report(ctx, params, "mean_usec", double(sum) / latencies.size() / 1000.0);
+			report(ctx, params, "p50_usec", latencies.at(latencies.size() / 2) / 1000.0);
+			report(ctx, params, "p99_usec", latencies.at(latencies.size() * 99 / 100) / 1000.0);
+		}
+	}
+
+	{
+		WakeUpState state;
+		state.dispatcher = d;
+		state.sent_at    = 0;
+		state.iterations = 0;
+		state.calls      = 0;
+		state.throughput = true;
+
+		quint64 iterations = 0;
+		QElapsedTimer clock;
+		clock.start();
+
+		WakeUpSender sender(&state);
+		sender.start();
+		while (clock.elapsed() < ctx.options->duration) {
+			d->processEvents(QEventLoop::WaitForMoreEvents);
+			++iterations;
+		}
+
+		state.stop.storeRelease(1);
+		sender.wait();
+		const qint64 run_time = clock.nsecsElapsed();
+
+		// Drain the last wakeup
+		d->processEvents(QEventLoop::AllEvents);
+
+		QByteArray params = param("mode", "throughput");
+		report(ctx, params, "wakeups_per_sec", perSecond(state.calls, run_time));
+		report(ctx, params, "iterations_per_sec", perSecond(iterations, run_time));
+	}
+}
+
+class ZeroTimerReceiver : public QObject {
+public:
+	explicit ZeroTimerReceiver(bool restart) : events(0), m_restart(restart) {}
+	quint64 events;
+
+protected:
+	virtual void timerEvent(QTimerEvent* e)
+	{
+		++this->events;
+		if (this->m_restart) {
+			// What a chain of single shot zero timers does
+			this->killTimer(e->timerId());
+			this->startTimer(0);
+		}
+	}
+
+private:
+	bool m_restart;
+};
+
+void benchmarkZeroTimers(const Context& ctx)
+{
+	{
+		ZeroTimerReceiver receiver(true);
+		receiver.startTimer(0);
+
+		QElapsedTimer clock;
+		clock.start();
+		spin(ctx.options->duration, QEventLoop::AllEvents);
+
+		report(ctx, param("mode", "single_shot"), "events_per_sec", perSecond(receiver.events, clock.nsecsElapsed()));
+	}
+
+	static const int counts[] = { 1, 100 };
+	for (int c=0; c<2; ++c) {
+		ZeroTimerReceiver receiver(false);
+		for (int i=0; i<counts[c]; ++i) {
+			receiver.startTimer(0);
+		}
+
+		QElapsedTimer clock;
+		clock.start();
+		spin(ctx.options->duration, QEventLoop::AllEvents);
+
+		report(ctx, param("mode", "repeating") + "," + param("count", counts[c]), "events_per_sec", perSecond(receiver.events, clock.nsecsElapsed()));
+	}
+}
+
+void benchmarkExcludeSocketNotifiers(const Context& ctx)
+{
+	static const int counts_full[]  = { 0, 100, 10000 };
+	static const int counts_quick[] = { 0, 100 };
+
+	const int* counts  = ctx.options->quick ? counts_quick : counts_full;
+	const int n_counts = ctx.options->quick ? 2 : 3;
+	const int limit    = raiseDescriptorLimit();
+	QAbstractEventDispatcher* d = QAbstractEventDispatcher::instance();
+
+	for (int c=0; c<n_counts; ++c) {
+		const int count = counts[c];
+		if (2 * count + 64 > limit) {
+			fprintf(stderr, "%s: skipping %d socket pairs, RLIMIT_NOFILE is %d\n", ctx.scenario, count, limit);
+			continue;
+		}
+
+		SocketPairs pairs;
+		if (!pairs.create(count, ctx.dispatcher)) {
+			fprintf(stderr, "%s: cannot create %d socket pairs for the %s dispatcher\n", ctx.scenario, count, ctx.dispatcher.constData());
+			continue;
+		}
+
+		// All descriptors are readable: the iterations must ignore them
+		quint64 activations = 0;
+		QVector<PingNotifier*> notifiers;
+		for (int i=0; i<count; ++i) {
+			notifiers.append(new PingNotifier(pairs.fds.at(2*i), pairs.fds.at(2*i + 1), &activations));
+			ssize_t res = write(pairs.fds.at(2*i + 1), "x", 1);
+			Q_UNUSED(res)
+		}
+
+		quint64 iterations = 0;
+		QElapsedTimer clock;
+		clock.start();
+		while (clock.elapsed() < ctx.options->duration) {
+			for (int i=0; i<1000; ++i) {
+				d->processEvents(QEventLoop::ExcludeSocketNotifiers);
+			}
+
+			iterations += 1000;
+		}
+
+		const qint64 run_time = clock.nsecsElapsed();
+		qDeleteAll(notifiers);
+
+		if (activations) {
+			fprintf(stderr, "%s: the %s dispatcher has activated %llu excluded notifiers\n", ctx.scenario, ctx.dispatcher.constData(), activations);
+		}
+
+		report(ctx, param("count", count), "nsec_per_iteration", iterations ? double(run_time) / iterations : 0.0);
+	}
+}
+
+class BenchmarkThread : public QThread {
+public:
+	BenchmarkThread(ScenarioFunc func, const Context& ctx) : m_func(func), m_ctx(ctx) {}
+
+protected:
+	virtual void run(void)
+	{
+		this->m_func(this->m_ctx);
+	}
+
+private:
+	ScenarioFunc m_func;
+	const Context& m_ctx;
+};
+
+void usage(const char* name)
+{
+	fprintf(
+		stderr,
+		"Usage: %s [--dispatchers=epoll,unix,glib,iouring] [--scenarios=timers,notifiers,wakeup,zerotimers,exclude]\n"
+		"       [--duration=msec] [--quick]\n",
+		name
+	);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	QCoreApplication app(argc, argv);
+
+	static const struct { const char* name; ScenarioFunc func; } scenarios[] = {
+		{ "timers",     benchmarkTimers                 },
+		{ "notifiers",  benchmarkNotifiers              },
+		{ "wakeup",     benchmarkWakeUp                 },
+		{ "zerotimers", benchmarkZeroTimers             },
+		{ "exclude",    benchmarkExcludeSocketNotifiers }
+	};
+
+	Options options;
+	options.duration = 1000;
+	options.quick    = false;
+	options.dispatchers << QLatin1String("epoll") << QLatin1String("unix");
+#ifdef HAVE_GLIB_DISPATCHER
+	options.dispatchers << QLatin1String("glib");
+#endif
+
+	for (int i=0; i<5; ++i) {
+		options.scenarios << QLatin1String(scenarios[i].name);
+	}
+
+#if QT_VERSION >= 0x050E00
+	const Qt::SplitBehavior skip_empty = Qt::SkipEmptyParts;
+#else
+	const QString::SplitBehavior skip_empty = QString::SkipEmptyParts;
+#endif
+
+	QStringList args = app.arguments();
+	for (int i=1; i<args.size(); ++i) {
+		const QString& arg = args.at(i);
+		if (arg.startsWith(QLatin1String("--dispatchers="))) {
+			options.dispatchers = arg.mid(14).split(QLatin1Char(','), skip_empty);
+		}
+		else if (arg.startsWith(QLatin1String("--scenarios="))) {
+			options.scenarios = arg.mid(12).split(QLatin1Char(','), skip_empty);
+		}
+		else if (arg.startsWith(QLatin1String("--duration="))) {
+			options.duration = qMax(arg.mid(11).toInt(), 10);
+		}
+		else if (arg == QLatin1String("--quick")) {
+			options.quick = true;
+		}
+		else {
+			usage(argv[0]);
+			return arg == QLatin1String("--help") ? 0 : 1;
+		}
+	}
+
+	for (int s=0; s<5; ++s) {
+		if (!options.scenarios.contains(QLatin1String(scenarios[s].name))) {
+			continue;
+		}
+
+		for (int i=0; i<options.dispatchers.size(); ++i) {
+			Context ctx;
+			ctx.options    = &options;
+			ctx.dispatcher = options.dispatchers.at(i).toLatin1();
+			ctx.scenario   = scenarios[s].name;
+
+			QAbstractEventDispatcher* dispatcher = createDispatcher(ctx.dispatcher);
+			if (!dispatcher) {
+				fprintf(stderr, "The %s dispatcher is not available\n", ctx.dispatcher.constData());
+				continue;
+			}
+
+			// The thread takes ownership of the dispatcher
+			BenchmarkThread thread(scenarios[s].func, ctx);
+			thread.setEventDispatcher(dispatcher);
+			thread.start();
+			thread.wait();
+		}
+	}
+
+	return 0;
+}
@@ -5,9 +5,16 @@ SUBDIRS  = src
 greaterThan(QT_MAJOR_VERSION, 4) {
 	SUBDIRS     += src-gui
 	src-gui.file = src-gui/eventdispatcher_epoll_qpa.pro
+
+	# The benchmark needs Qt's private headers: qmake CONFIG+=benchmarks
+	CONFIG(benchmarks) {
+		SUBDIRS        += benchmarks
+		benchmarks.file = benchmarks/benchmarks.pro
+	}
 }
 
-SUBDIRS += tests
+SUBDIRS += tests epoll_tests
 
-src.file   = src/eventdispatcher_epoll.pro
-tests.file = tests/qt_eventdispatcher_tests/build.pro
+src.file         = src/eventdispatcher_epoll.pro
+tests.file       = tests/qt_eventdispatcher_tests/build.pro
+epoll_tests.file = tests/epoll/tst_eventdispatcher_epoll.pro
@@ -2,7 +2,7 @@
 
 set -e
 
-qmake
+qmake "$@"
 make
 cd tests
 for i in ./tst_*; do ./$i; done
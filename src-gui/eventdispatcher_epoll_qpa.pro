@@ -10,3 +10,8 @@ LIBS           += -L$$PWD/../lib -leventdispatcher_epoll
 INCLUDEPATH    += $$PWD/../src
 DEPENDPATH     += $$PWD/../src
 PRE_TARGETDEPS += $$DESTDIR/../lib/libeventdispatcher_epoll.a
+
+CONFIG(iouring) {
+	SOURCES += eventdispatcher_iouring_qpa.cpp
+	HEADERS += eventdispatcher_iouring_qpa.h
+}
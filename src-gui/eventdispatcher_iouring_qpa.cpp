@@ -0,0 +1,36 @@
+#include <qplatformdefs.h>
+#include <qpa/qwindowsysteminterface.h>
+#include <QtGui/QGuiApplication>
+#include "eventdispatcher_iouring_qpa.h"
+
+EventDispatcherIOUringQPA::EventDispatcherIOUringQPA(QObject* parent)
+	: EventDispatcherIOUring(parent)
+{
+}
+
+EventDispatcherIOUringQPA::~EventDispatcherIOUringQPA(void)
+{
+}
+
+bool EventDispatcherIOUringQPA::processEvents(QEventLoop::ProcessEventsFlags flags)
+{
+	bool sent_events = QWindowSystemInterface::sendWindowSystemEvents(flags);
+
+	if (EventDispatcherIOUring::processEvents(flags)) {
+		return true;
+	}
+
+	return sent_events;
+}
+
+bool EventDispatcherIOUringQPA::hasPendingEvents(void)
+{
+	return EventDispatcherIOUring::hasPendingEvents() || QWindowSystemInterface::windowSystemEventsQueued();
+}
+
+void EventDispatcherIOUringQPA::flush(void)
+{
+	if (qApp) {
+		qApp->sendPostedEvents();
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef EVENTDISPATCHER_IOURING_QPA_H
+#define EVENTDISPATCHER_IOURING_QPA_H
+
+#include "eventdispatcher_iouring.h"
+
+#if QT_VERSION < 0x050000
+#	error This code requires at least Qt 5
+#endif
+
+class EventDispatcherIOUringQPA : public EventDispatcherIOUring {
+	Q_OBJECT
+public:
+	explicit EventDispatcherIOUringQPA(QObject* parent = 0);
+	virtual ~EventDispatcherIOUringQPA(void) Q_DECL_OVERRIDE;
+
+	bool processEvents(QEventLoop::ProcessEventsFlags flags) Q_DECL_OVERRIDE;
+	bool hasPendingEvents(void) Q_DECL_OVERRIDE;
+	void flush(void) Q_DECL_OVERRIDE;
+
+private:
+	Q_DISABLE_COPY(EventDispatcherIOUringQPA)
+};
+
+#endif // EVENTDISPATCHER_IOURING_QPA_H
@@ -25,8 +25,13 @@ bool EventDispatcherEPoll::processEvents(QEventLoop::ProcessEventsFlags flags)
 
 bool EventDispatcherEPoll::hasPendingEvents(void)
 {
+#if QT_VERSION >= 0x040400
+	Q_D(const EventDispatcherEPoll);
+	return d->hasPendingEvents();
+#else
 	extern uint qGlobalPostedEventsCount();
 	return qGlobalPostedEventsCount() > 0;
+#endif
 }
 
 void EventDispatcherEPoll::registerSocketNotifier(QSocketNotifier* notifier)
@@ -94,14 +99,55 @@ void EventDispatcherEPoll::registerTimer(
 #endif
 
 	Q_D(EventDispatcherEPoll);
-	if (interval) {
-		d->registerTimer(timerId, interval, type, object);
+	if (d->m_precise_interval) {
+		d->registerTimer(timerId, d->m_precise_interval, Qt::PreciseTimer, object);
+		d->m_precise_interval = 0;
+	}
+	else if (interval) {
+		d->registerTimer(timerId, qint64(interval) * 1000000, type, object);
 	}
 	else {
 		d->registerZeroTimer(timerId, object);
 	}
 }
 
+int EventDispatcherEPoll::registerPreciseTimer(qint64 interval, QObject* object)
+{
+	if (Q_UNLIKELY(interval <= 0 || !object)) {
+		qWarning("%s: invalid arguments", Q_FUNC_INFO);
+		return 0;
+	}
+
+	if (Q_UNLIKELY(object->thread() != this->thread() || this->thread() != QThread::currentThread())) {
+		qWarning("%s: timers cannot be started from another thread", Q_FUNC_INFO);
+		return 0;
+	}
+
+	// QObject::startTimer() goes to the dispatcher of the object's thread, which may not be this one
+	if (Q_UNLIKELY(QAbstractEventDispatcher::instance(object->thread()) != this)) {
+		qWarning("%s: the dispatcher is not the one of the object's thread", Q_FUNC_INFO);
+		return 0;
+	}
+
+	// QObject::startTimer() allocates the ID and makes QObject::killTimer() work; registerTimer() picks up the real interval
+	Q_D(EventDispatcherEPoll);
+	const int msec = static_cast<int>(qMin((interval + 999999) / 1000000, qint64(INT_MAX)));
+	d->m_precise_interval = interval;
+#if QT_VERSION >= 0x050000
+	int id = object->startTimer(msec, Qt::PreciseTimer);
+#else
+	int id = object->startTimer(msec);
+#endif
+	d->m_precise_interval = 0;
+	return id;
+}
+
+int EventDispatcherEPoll::timerOverruns(int timerId) const
+{
+	Q_D(const EventDispatcherEPoll);
+	return d->timerOverruns(timerId);
+}
+
 bool EventDispatcherEPoll::unregisterTimer(int timerId)
 {
 #ifndef QT_NO_DEBUG
@@ -173,3 +219,129 @@ void EventDispatcherEPoll::interrupt(void)
 void EventDispatcherEPoll::flush(void)
 {
 }
+
+EventDispatcherEPoll::PoolStatistics EventDispatcherEPoll::poolStatistics(void) const
+{
+	Q_D(const EventDispatcherEPoll);
+	return d->poolStatistics();
+}
+
+#if QT_VERSION >= 0x040400
+void EventDispatcherEPoll::post(EventDispatcherEPoll::TaskFunction func, void* context)
+{
+	Q_ASSERT(func != 0);
+	this->postTask(func, 0, context);
+}
+
+void EventDispatcherEPoll::postTask(EventDispatcherEPoll::TaskFunction run, EventDispatcherEPoll::TaskFunction drop, void* context)
+{
+	Q_D(EventDispatcherEPoll);
+	d->postTask(run, drop, context);
+}
+#endif
+
+void EventDispatcherEPoll::setDispatchBudget(int max_events, int max_usec)
+{
+	Q_D(EventDispatcherEPoll);
+	d->m_budget_events = qMax(max_events, 0);
+	d->m_budget_usec   = qMax(max_usec, 0);
+}
+
+void EventDispatcherEPoll::setBusyPolling(int max_usec)
+{
+	Q_D(EventDispatcherEPoll);
+	d->setBusyPolling(qMax(max_usec, 0));
+}
+
+int EventDispatcherEPoll::busyPolling(void) const
+{
+	Q_D(const EventDispatcherEPoll);
+	return static_cast<int>(d->m_busy_poll_max);
+}
+
+void EventDispatcherEPoll::setEdgeTriggered(bool enable)
+{
+	Q_D(EventDispatcherEPoll);
+	d->m_edge_triggered = enable;
+}
+
+bool EventDispatcherEPoll::isEdgeTriggered(void) const
+{
+	Q_D(const EventDispatcherEPoll);
+	return d->m_edge_triggered;
+}
+
+bool EventDispatcherEPoll::watchSignal(int signo, EventDispatcherEPoll::SignalCallback callback, void* context)
+{
+	Q_ASSERT(callback != 0);
+	return this->addSignalWatch(signo, callback, 0, context);
+}
+
+bool EventDispatcherEPoll::addSignalWatch(int signo, EventDispatcherEPoll::SignalCallback callback, void (*drop)(void*), void* context)
+{
+	Q_D(EventDispatcherEPoll);
+	return d->watchSignal(signo, callback, drop, context);
+}
+
+void EventDispatcherEPoll::unwatchSignal(int signo)
+{
+	Q_D(EventDispatcherEPoll);
+	d->unwatchSignal(signo);
+}
+
+bool EventDispatcherEPoll::watchDescriptor(int fd, uint events, EventDispatcherEPoll::DescriptorCallback callback, void* context)
+{
+	Q_ASSERT(callback != 0);
+	return this->addDescriptorWatch(fd, events, callback, 0, context);
+}
+
+bool EventDispatcherEPoll::addDescriptorWatch(int fd, uint events, EventDispatcherEPoll::DescriptorCallback callback, void (*drop)(void*), void* context)
+{
+	Q_D(EventDispatcherEPoll);
+	return d->watchDescriptor(fd, events, callback, drop, context);
+}
+
+bool EventDispatcherEPoll::setDescriptorEvents(int fd, uint events)
+{
+	Q_D(EventDispatcherEPoll);
+	return d->setDescriptorEvents(fd, events);
+}
+
+void EventDispatcherEPoll::unwatchDescriptor(int fd)
+{
+	Q_D(EventDispatcherEPoll);
+	d->unwatchDescriptor(fd);
+}
+
+void EventDispatcherEPoll::setStatisticsEnabled(bool enable)
+{
+	Q_D(EventDispatcherEPoll);
+	d->setStatisticsEnabled(enable);
+}
+
+bool EventDispatcherEPoll::isStatisticsEnabled(void) const
+{
+	Q_D(const EventDispatcherEPoll);
+	return d->m_stats_enabled;
+}
+
+EventDispatcherEPoll::Statistics EventDispatcherEPoll::statistics(void) const
+{
+	Q_D(const EventDispatcherEPoll);
+	return d->statistics();
+}
+
+void EventDispatcherEPoll::setSlowHandlerWatchdog(int budget, EventDispatcherEPoll::SlowHandlerCallback callback, void* context)
+{
+	Q_D(EventDispatcherEPoll);
+	if (budget > 0 && callback) {
+		d->m_watchdog_budget   = budget;
+		d->m_watchdog_callback = callback;
+		d->m_watchdog_context  = context;
+	}
+	else {
+		d->m_watchdog_budget   = 0;
+		d->m_watchdog_callback = 0;
+		d->m_watchdog_context  = 0;
+	}
+}
@@ -3,7 +3,14 @@
 
 #include <QtCore/QAbstractEventDispatcher>
 
+#if defined(Q_COMPILER_LAMBDA) || __cplusplus >= 201103L
+#	include <chrono>
+#	include <functional>
+#	define EVENTDISPATCHER_EPOLL_CXX11
+#endif
+
 class EventDispatcherEPollPrivate;
+struct signalfd_siginfo;
 
 class EventDispatcherEPoll : public QAbstractEventDispatcher {
 	Q_OBJECT
@@ -37,7 +44,219 @@ public:
 	virtual void interrupt(void);
 	virtual void flush(void);
 
+	// Bookkeeping records allocated by the dispatcher: currently in use and the high-water mark
+	struct PoolStatistics {
+		int handles;
+		int handles_high_water;
+		int timers;
+		int timers_high_water;
+		int timer_slots;
+		int timer_slots_high_water;
+		int zero_timers;
+		int zero_timers_high_water;
+	};
+
+	// Must be called from the dispatcher's thread
+	PoolStatistics poolStatistics(void) const;
+
+	// Event loop counters; times are in microseconds
+	struct Statistics {
+		quint64 iterations;              // processEvents() calls
+		quint64 epoll_waits;             // epoll_wait() calls
+		quint64 epoll_events;            // events returned by epoll_wait()
+		quint64 blocked_time;            // time spent in epoll_wait()
+		quint64 busy_time;               // all other time since the statistics were enabled
+		quint64 busy_poll_hits;          // waits that busy polling has ended without blocking (events or wakeUp() in time)
+		quint64 busy_poll_misses;        // waits that have had to block after busy polling
+		quint64 busy_poll_time;          // time spent busy polling (included in busy_time)
+		quint64 timer_events[3];         // timer events sent, indexed by Qt::TimerType
+		quint64 timer_lateness;          // total delay of the timer events past their deadlines
+		quint64 timer_max_lateness;
+		quint64 zero_timer_events;
+		quint64 read_events;             // socket notifier activations by notifier type
+		quint64 write_events;
+		quint64 exception_events;
+		quint64 error_events;            // EPOLLERR and EPOLLHUP reported for socket notifiers
+		quint64 descriptor_events;       // descriptor watcher callbacks
+		quint64 wakeups_requested;       // wakeUp() calls
+		quint64 wakeups_written;         // wakeUp() calls that actually had to write to the eventfd
+		quint64 epoll_ctl_add;           // socket notifier registrations by epoll_ctl() operation
+		quint64 epoll_ctl_mod;
+		quint64 epoll_ctl_del;
+	};
+
+	// Statistics are disabled by default; a disabled dispatcher only tests a flag here and there.
+	// Enabling the statistics resets the counters. Must be called from the dispatcher's thread
+	void setStatisticsEnabled(bool enable);
+	bool isStatisticsEnabled(void) const;
+
+	// The counters as of the end of the last event loop iteration. The snapshot is consistent
+	// and can be taken from any thread without blocking the dispatcher
+	Statistics statistics(void) const;
+
+	// Describes an event handler that has exceeded the watchdog budget
+	struct SlowHandlerReport {
+		enum Kind {
+			SocketRead,
+			SocketWrite,
+			SocketException,
+			Timer,
+			ZeroTimer,
+			Descriptor
+		};
+
+		Kind kind;
+		int id;                // socket descriptor or timer ID
+		qint64 duration;       // microseconds
+		const char* className; // the receiver's, captured before the event is sent, as the handler may delete the receiver; empty for descriptor watchers
+		QString objectName;
+	};
+
+	typedef void (*SlowHandlerCallback)(const SlowHandlerReport& report, void* context);
+
+	// When the watchdog is on, every socket notifier activation and timer event is timed, and the callback is called
+	// (from the dispatcher's thread, right after the handler returns) for each one that has taken longer than budget
+	// microseconds. A non-positive budget or a null callback turns the watchdog off. Must be called from the dispatcher's thread
+	void setSlowHandlerWatchdog(int budget, SlowHandlerCallback callback, void* context = 0);
+
+	// Limits the number of socket notifier activations per event loop iteration by count and/or by time (in microseconds);
+	// zero means no limit. Descriptors that are ready but do not fit into the budget are served first on the next
+	// iteration, after posted events and timers have had their chance. Must be called from the dispatcher's thread
+	void setDispatchBudget(int max_events, int max_usec = 0);
+
+	// Latency mode: before blocking in epoll_wait(), the event loop keeps polling for events for up to max_usec
+	// microseconds. The actual polling time adapts to the recent intervals between the events: it shrinks to zero
+	// when events do not tend to arrive within max_usec. Where supported (Linux >= 6.9), this also enables
+	// in-kernel busy polling of the network devices (EPIOCSPARAMS) for the same time, except while the adaptive
+	// polling time is zero. Zero turns the mode off.
+	// Must be called from the dispatcher's thread
+	void setBusyPolling(int max_usec);
+	int busyPolling(void) const;
+
+#if QT_VERSION >= 0x040400
+	typedef void (*TaskFunction)(void* context);
+
+	// Makes processEvents() call func(context) on the dispatcher's thread. Can be called from any thread and
+	// takes no locks; a burst of posts wakes the event loop up once. Tasks run in the order they were posted.
+	// Tasks still queued when the dispatcher is destroyed are discarded without being run
+	void post(TaskFunction func, void* context);
+
+#	ifdef EVENTDISPATCHER_EPOLL_CXX11
+	void post(std::function<void()> task)
+	{
+		this->postTask(&EventDispatcherEPoll::runFunction, &EventDispatcherEPoll::dropFunction, new std::function<void()>(std::move(task)));
+	}
+#	endif
+#endif
+
+	// Starts a Qt::PreciseTimer with an interval in nanoseconds on object, which must live in the dispatcher's thread,
+	// and the dispatcher must be that thread's event dispatcher. Returns the timer ID or 0 on failure. The timer is an ordinary Qt timer otherwise: it is stopped with
+	// QObject::killTimer(), and registeredTimers() reports its interval rounded up to milliseconds
+	int registerPreciseTimer(qint64 interval, QObject* object);
+
+#ifdef EVENTDISPATCHER_EPOLL_CXX11
+	int registerTimer(std::chrono::nanoseconds interval, QObject* object)
+	{
+		return this->registerPreciseTimer(interval.count(), object);
+	}
+#endif
+
+	// Precise timers do not drift: when the event loop falls behind, the missed expirations are coalesced into one
+	// timer event and the timer stays on its original schedule. Returns the number of expirations coalesced into
+	// the timer's current (or last) event, so that its handler can catch up; 0 for other timer types, -1 for an unknown ID
+	int timerOverruns(int timerId) const;
+
+	// Descriptors that get their first socket notifier after this call are registered edge-triggered (EPOLLET).
+	// An edge-triggered notifier is activated when its descriptor becomes ready and is not activated again
+	// until the readiness changes (more data arrives, more buffer space becomes available);
+	// the handler must therefore read or write until EAGAIN. Re-enabling the notifier re-arms it:
+	// if the descriptor is ready at that time, the notifier is activated again.
+	// The mode of a descriptor does not change while it has registered notifiers.
+	void setEdgeTriggered(bool enable);
+	bool isEdgeTriggered(void) const;
+
+	typedef void (*SignalCallback)(const struct signalfd_siginfo& info, void* context);
+
+	// Delivers the UNIX signal signo through a signalfd: the signal is blocked in the calling thread, and callback
+	// is called on the dispatcher's thread for every instance of it. All queued signals are read at once;
+	// standard signals that arrive while one is pending are merged by the kernel (reap children with waitpid() in a loop).
+	// Other threads must have the signal blocked too, so block it before they start. Watching a signal again replaces
+	// the callback. Returns false if the signal cannot be watched. Must be called from the dispatcher's thread
+	bool watchSignal(int signo, SignalCallback callback, void* context = 0);
+
+#ifdef EVENTDISPATCHER_EPOLL_CXX11
+	bool watchSignal(int signo, std::function<void(const struct signalfd_siginfo&)> handler)
+	{
+		return this->addSignalWatch(signo, &EventDispatcherEPoll::runSignalFunction, &EventDispatcherEPoll::dropSignalFunction, new std::function<void(const struct signalfd_siginfo&)>(std::move(handler)));
+	}
+#endif
+
+	// The signal stays blocked; its instances are left pending. Must be called from the dispatcher's thread
+	void unwatchSignal(int signo);
+
+	typedef void (*DescriptorCallback)(int fd, uint events, void* context);
+
+	// Watches fd without a QSocketNotifier: when the descriptor is ready, callback is called right from the event loop
+	// with the events reported by epoll_wait(), with no QEvent, event filters or signals involved. events is an epoll
+	// interest set (EPOLLIN, EPOLLOUT, EPOLLPRI, EPOLLRDHUP, EPOLLET, EPOLLONESHOT); EPOLLERR and EPOLLHUP are always reported.
+	// A descriptor can have either a watcher or socket notifiers. Watching a watched descriptor replaces its interest set
+	// and callback. The watcher must be removed before the descriptor is closed. Returns false if fd cannot be watched.
+	// Must be called from the dispatcher's thread, as must the functions below
+	bool watchDescriptor(int fd, uint events, DescriptorCallback callback, void* context = 0);
+
+#ifdef EVENTDISPATCHER_EPOLL_CXX11
+	bool watchDescriptor(int fd, uint events, std::function<void(int, uint)> handler)
+	{
+		return this->addDescriptorWatch(fd, events, &EventDispatcherEPoll::runDescriptorFunction, &EventDispatcherEPoll::dropDescriptorFunction, new std::function<void(int, uint)>(std::move(handler)));
+	}
+#endif
+
+	// Changes the interest set of a watched descriptor, like enabling and disabling socket notifiers does:
+	// the change reaches the kernel before the next epoll_wait(). Setting it again re-arms EPOLLET and EPOLLONESHOT watchers
+	bool setDescriptorEvents(int fd, uint events);
+	void unwatchDescriptor(int fd);
+
 private:
+	friend class EventDispatcherEPollGroup;
+#if QT_VERSION >= 0x040400
+	void postTask(TaskFunction run, TaskFunction drop, void* context);
+#	ifdef EVENTDISPATCHER_EPOLL_CXX11
+	static void runFunction(void* context)
+	{
+		std::function<void()>* f = static_cast<std::function<void()>*>(context);
+		(*f)();
+		delete f;
+	}
+
+	static void dropFunction(void* context)
+	{
+		delete static_cast<std::function<void()>*>(context);
+	}
+#	endif
+#endif
+	bool addSignalWatch(int signo, SignalCallback callback, void (*drop)(void*), void* context);
+	bool addDescriptorWatch(int fd, uint events, DescriptorCallback callback, void (*drop)(void*), void* context);
+#ifdef EVENTDISPATCHER_EPOLL_CXX11
+	static void runSignalFunction(const struct signalfd_siginfo& info, void* context)
+	{
+		(*static_cast<std::function<void(const struct signalfd_siginfo&)>*>(context))(info);
+	}
+
+	static void dropSignalFunction(void* context)
+	{
+		delete static_cast<std::function<void(const struct signalfd_siginfo&)>*>(context);
+	}
+
+	static void runDescriptorFunction(int fd, uint events, void* context)
+	{
+		(*static_cast<std::function<void(int, uint)>*>(context))(fd, events);
+	}
+
+	static void dropDescriptorFunction(void* context)
+	{
+		delete static_cast<std::function<void(int, uint)>*>(context);
+	}
+#endif
 	Q_DISABLE_COPY(EventDispatcherEPoll)
 	Q_DECLARE_PRIVATE(EventDispatcherEPoll)
 #if QT_VERSION >= 0x040600
@@ -3,10 +3,18 @@ TARGET    = eventdispatcher_epoll
 TEMPLATE  = lib
 DESTDIR   = ../lib
 CONFIG   += staticlib create_prl create_pc
-HEADERS  += eventdispatcher_epoll.h eventdispatcher_epoll_p.h qt4compat.h
-SOURCES  += eventdispatcher_epoll.cpp eventdispatcher_epoll_p.cpp timers_p.cpp socknot_p.cpp
+HEADERS  += eventdispatcher_epoll.h eventdispatcher_epoll_p.h eventdispatcher_epoll_group.h objectpool_p.h qt4compat.h
+SOURCES  += eventdispatcher_epoll.cpp eventdispatcher_epoll_p.cpp eventdispatcher_epoll_group.cpp timers_p.cpp socknot_p.cpp signals_p.cpp
+
+headers.files = eventdispatcher_epoll.h eventdispatcher_epoll_group.h
+
+# The io_uring backend needs kernel headers >= 5.13: qmake CONFIG+=iouring
+CONFIG(iouring) {
+	HEADERS       += eventdispatcher_iouring.h eventdispatcher_iouring_p.h
+	SOURCES       += eventdispatcher_iouring.cpp eventdispatcher_iouring_p.cpp timers_iouring_p.cpp socknot_iouring_p.cpp
+	headers.files += eventdispatcher_iouring.h
+}
 
-headers.files = eventdispatcher_epoll.h
 headers.path  = /usr/include
 target.path   = /usr/lib
 
@@ -0,0 +1,207 @@
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+#include <sys/socket.h>
+#include <algorithm>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include "eventdispatcher_epoll_group.h"
+#include "eventdispatcher_epoll_p.h"
+#include "qt4compat.h"
+
+#ifndef SO_REUSEPORT
+#	define SO_REUSEPORT 15
+#endif
+
+class Q_DECL_HIDDEN EventDispatcherEPollGroupPrivate {
+public:
+	EventDispatcherEPollGroupPrivate(void) : m_lock(), m_dispatchers(), m_shared() {}
+
+	mutable QMutex m_lock;
+	QList<EventDispatcherEPoll*> m_dispatchers;
+	QVector<int> m_shared; // sorted, copied into every member
+
+private:
+	Q_DISABLE_COPY(EventDispatcherEPollGroupPrivate)
+};
+
+EventDispatcherEPollGroup::EventDispatcherEPollGroup(void)
+	: d_ptr(new EventDispatcherEPollGroupPrivate())
+{
+}
+
+EventDispatcherEPollGroup::~EventDispatcherEPollGroup(void)
+{
+	Q_D(EventDispatcherEPollGroup);
+	QMutexLocker locker(&d->m_lock);
+	// The members still left stop sharing the descriptors at their next iteration
+	for (int i=0; i<d->m_dispatchers.size(); ++i) {
+		publishShared(d->m_dispatchers.at(i), QVector<int>());
+		d->m_dispatchers.at(i)->d_func()->m_group = 0;
+	}
+
+	d->m_dispatchers.clear();
+	locker.unlock();
+
+#if QT_VERSION < 0x040600
+	delete this->d_ptr;
+	this->d_ptr = 0;
+#endif
+}
+
+void EventDispatcherEPollGroup::addDispatcher(EventDispatcherEPoll* dispatcher)
+{
+	Q_ASSERT(dispatcher != 0);
+
+	Q_D(EventDispatcherEPollGroup);
+	QMutexLocker locker(&d->m_lock);
+
+	EventDispatcherEPollPrivate* dd = dispatcher->d_func();
+	if (Q_UNLIKELY(dd->m_group != 0)) {
+		qWarning("%s: the dispatcher already belongs to a group", Q_FUNC_INFO);
+		return;
+	}
+
+	dd->m_group = this;
+	publishShared(dispatcher, d->m_shared);
+	d->m_dispatchers.append(dispatcher);
+}
+
+void EventDispatcherEPollGroup::removeDispatcher(EventDispatcherEPoll* dispatcher)
+{
+	Q_D(EventDispatcherEPollGroup);
+	QMutexLocker locker(&d->m_lock);
+
+	int idx = d->m_dispatchers.indexOf(dispatcher);
+	if (idx != -1) {
+		d->m_dispatchers.removeAt(idx);
+		dispatcher->d_func()->m_group = 0;
+		publishShared(dispatcher, QVector<int>());
+	}
+}
+
+QList<EventDispatcherEPoll*> EventDispatcherEPollGroup::dispatchers(void) const
+{
+	Q_D(const EventDispatcherEPollGroup);
+	QMutexLocker locker(&d->m_lock);
+	return d->m_dispatchers;
+}
+
+void EventDispatcherEPollGroup::addSharedDescriptor(int fd)
+{
+	Q_D(EventDispatcherEPollGroup);
+	QMutexLocker locker(&d->m_lock);
+
+	QVector<int>::iterator it = std::lower_bound(d->m_shared.begin(), d->m_shared.end(), fd);
+	if (it == d->m_shared.end() || *it != fd) {
+		d->m_shared.insert(it, fd);
+		this->updateMembers();
+	}
+}
+
+void EventDispatcherEPollGroup::removeSharedDescriptor(int fd)
+{
+	Q_D(EventDispatcherEPollGroup);
+	QMutexLocker locker(&d->m_lock);
+
+	QVector<int>::iterator it = std::lower_bound(d->m_shared.begin(), d->m_shared.end(), fd);
+	if (it != d->m_shared.end() && *it == fd) {
+		d->m_shared.erase(it);
+		this->updateMembers();
+	}
+}
+
+void EventDispatcherEPollGroup::updateMembers(void)
+{
+	Q_D(EventDispatcherEPollGroup);
+	for (int i=0; i<d->m_dispatchers.size(); ++i) {
+		publishShared(d->m_dispatchers.at(i), d->m_shared);
+	}
+}
+
+void EventDispatcherEPollGroup::publishShared(EventDispatcherEPoll* dispatcher, const QVector<int>& shared)
+{
+	EventDispatcherEPollPrivate* dd = dispatcher->d_func();
+#if QT_VERSION >= 0x040400
+	// The dispatcher's thread takes the copy over with an atomic exchange; a copy it has not taken yet is replaced
+	delete dd->m_shared_update.fetchAndStoreRelease(new QVector<int>(shared));
+#else
+	dd->m_shared = shared;
+#endif
+}
+
+bool EventDispatcherEPollGroup::isSharedDescriptor(int fd) const
+{
+	Q_D(const EventDispatcherEPollGroup);
+	QMutexLocker locker(&d->m_lock);
+	return std::binary_search(d->m_shared.constBegin(), d->m_shared.constEnd(), fd);
+}
+
+QVector<int> EventDispatcherEPollGroup::createReusePortListeners(const struct sockaddr* addr, socklen_t len, int backlog) const
+{
+	QVector<int> res;
+
+	if (Q_UNLIKELY(!addr || len <= 0 || len > static_cast<socklen_t>(sizeof(struct sockaddr_storage)))) {
+		qWarning("%s: invalid arguments", Q_FUNC_INFO);
+		return res;
+	}
+
+	int count = this->dispatchers().size();
+
+	// If the port is to be chosen by the kernel, all other listeners must use the port chosen for the first one
+	struct sockaddr_storage bind_addr;
+	socklen_t bind_len = len;
+	memcpy(&bind_addr, addr, len);
+
+	bool ok = true;
+	for (int i=0; i<count && ok; ++i) {
+		ok = false;
+
+		int fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (Q_UNLIKELY(-1 == fd)) {
+			qErrnoWarning("%s: socket() failed", Q_FUNC_INFO);
+			continue;
+		}
+
+		res.append(fd);
+
+		const int on = 1;
+		if (Q_UNLIKELY(
+			   -1 == setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on))
+			|| -1 == setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))
+		)) {
+			qErrnoWarning("%s: setsockopt() failed", Q_FUNC_INFO);
+			continue;
+		}
+
+		if (Q_UNLIKELY(-1 == bind(fd, reinterpret_cast<struct sockaddr*>(&bind_addr), bind_len))) {
+			qErrnoWarning("%s: bind() failed", Q_FUNC_INFO);
+			continue;
+		}
+
+		if (Q_UNLIKELY(-1 == listen(fd, backlog))) {
+			qErrnoWarning("%s: listen() failed", Q_FUNC_INFO);
+			continue;
+		}
+
+		if (0 == i) {
+			bind_len = sizeof(bind_addr);
+			if (Q_UNLIKELY(-1 == getsockname(fd, reinterpret_cast<struct sockaddr*>(&bind_addr), &bind_len))) {
+				qErrnoWarning("%s: getsockname() failed", Q_FUNC_INFO);
+				continue;
+			}
+		}
+
+		ok = true;
+	}
+
+	if (Q_UNLIKELY(!ok)) {
+		for (int i=0; i<res.size(); ++i) {
+			close(res.at(i));
+		}
+
+		res.clear();
+	}
+
+	return res;
+}
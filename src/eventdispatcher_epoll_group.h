@@ -0,0 +1,56 @@
+#ifndef EVENTDISPATCHER_EPOLL_GROUP_H
+#define EVENTDISPATCHER_EPOLL_GROUP_H
+
+#include <QtCore/QList>
+#include <QtCore/QVector>
+#include <sys/socket.h>
+#include "eventdispatcher_epoll.h"
+
+class EventDispatcherEPollGroupPrivate;
+
+// Spreads the load of accept-heavy servers across the event dispatchers of several threads.
+//
+// A descriptor shared by the group (typically a listening socket) is registered with EPOLLEXCLUSIVE
+// in every member that gets a socket notifier for it, so each incoming connection wakes up one thread
+// instead of all of them. Alternatively, createReusePortListeners() gives every member its own
+// SO_REUSEPORT listening socket and lets the kernel balance the connections.
+//
+// Every member keeps its own copy of the shared descriptors and reads it without locking. The group publishes
+// a new copy whenever the set changes, and a running member takes it over before its next epoll_wait():
+// descriptors that join or leave the set then switch EPOLLEXCLUSIVE, even if they already have notifiers.
+// With Qt < 4.4 the copy is assigned directly, so dispatchers must be added, and descriptors shared,
+// before the members' threads start processing events.
+// A dispatcher leaves its group when it is destroyed, and the group must outlive its members;
+// destroying the group detaches the remaining members. All methods are thread-safe.
+class EventDispatcherEPollGroup {
+public:
+	EventDispatcherEPollGroup(void);
+	~EventDispatcherEPollGroup(void);
+
+	void addDispatcher(EventDispatcherEPoll* dispatcher);
+	void removeDispatcher(EventDispatcherEPoll* dispatcher);
+	QList<EventDispatcherEPoll*> dispatchers(void) const;
+
+	// Only read and write notifiers can share a descriptor exclusively (EPOLLEXCLUSIVE does not support EPOLLPRI);
+	// an exception notifier makes the descriptor a regular one in that member
+	void addSharedDescriptor(int fd);
+	void removeSharedDescriptor(int fd);
+	bool isSharedDescriptor(int fd) const;
+
+	// Creates one non-blocking listening socket per member, all bound to addr with SO_REUSEPORT;
+	// the i-th socket is meant for the i-th member of dispatchers(). Returns an empty vector on failure
+	QVector<int> createReusePortListeners(const struct sockaddr* addr, socklen_t len, int backlog = SOMAXCONN) const;
+
+private:
+	void updateMembers(void); // must be called with the lock held
+	static void publishShared(EventDispatcherEPoll* dispatcher, const QVector<int>& shared);
+	Q_DISABLE_COPY(EventDispatcherEPollGroup)
+	Q_DECLARE_PRIVATE(EventDispatcherEPollGroup)
+#if QT_VERSION >= 0x040600
+	QScopedPointer<EventDispatcherEPollGroupPrivate> d_ptr;
+#else
+	EventDispatcherEPollGroupPrivate* d_ptr;
+#endif
+};
+
+#endif // EVENTDISPATCHER_EPOLL_GROUP_H
@@ -1,52 +1,159 @@
 #include <QtCore/QCoreApplication>
+#include <QtCore/QVarLengthArray>
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <errno.h>
 #include "eventdispatcher_epoll.h"
 #include "eventdispatcher_epoll_p.h"
+#include "eventdispatcher_epoll_group.h"
 #include "qt4compat.h"
 
+#ifndef EPIOCSPARAMS
+struct epoll_params {
+	quint32 busy_poll_usecs;
+	quint16 busy_poll_budget;
+	quint8 prefer_busy_poll;
+	quint8 __pad;
+};
+
+#	define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+namespace {
+	inline qint64 monotonicTime(void)
+	{
+		return monotonicClock() / 1000;
+	}
+}
+
 EventDispatcherEPollPrivate::EventDispatcherEPollPrivate(EventDispatcherEPoll* const q)
 	: q_ptr(q),
-	  m_epoll_fd(-1), m_event_fd(-1),
-	  m_interrupt(false),
+	  m_epoll_fd(-1), m_control_fd(-1), m_event_fd(-1), m_timer_fd(-1), m_group(0), m_shared(),
+#if QT_VERSION >= 0x040400
+	  m_shared_update(0),
+#endif
+	  m_interrupt(false), m_edge_triggered(false), m_timers_pending(false), m_timer_armed(false),
+	  m_timer_deadline(0), m_timer_interval(0), m_now(monotonicClock()), m_precise_interval(0),
 #if QT_VERSION >= 0x040400
-	  m_wakeups(),
+	  m_wakeups(), m_sleeping(), m_tasks(0),
 #endif
-	  m_handles(), m_notifiers(), m_timers(), m_zero_timers()
+	  m_stats_enabled(false), m_stats_start(0), m_stats(), m_stats_copy(),
+#if QT_VERSION >= 0x040400
+	  m_stats_seq(), m_stats_wakeups_requested(), m_stats_wakeups_written(),
+#endif
+	  m_watchdog_budget(0), m_watchdog_callback(0), m_watchdog_context(0),
+	  m_busy_poll_max(0), m_busy_poll_budget(0), m_idle_average(0), m_kernel_busy_poll(false),
+	  m_handle_pool(), m_timer_pool(), m_slot_pool(), m_zero_timer_pool(),
+	  m_handles(), m_generation(0), m_changes(), m_dispatch_depth(0),
+	  m_events(256), m_events_peak(0), m_events_window(0), m_budget_events(0), m_budget_usec(0), m_ready(), m_ready_head(0),
+	  m_timers(), m_timer_heap(), m_expired(), m_expired_head(0), m_slots(), m_slot_count(0), m_slot_heap(),
+	  m_zero_timers(), m_zero_first(0), m_zero_last(0),
+	  m_zero_generation(0), m_zero_dispatch_depth(0), m_zero_dead(0),
+	  m_signal_fd(-1), m_signal_mask(), m_signal_watches(), m_dead_contexts(), m_callback_depth(0)
 {
+	sigemptyset(&this->m_signal_mask);
+
 	this->m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 	if (Q_UNLIKELY(-1 == this->m_epoll_fd)) {
 		qErrnoWarning("epoll_create1() failed");
 		abort();
 	}
 
+	this->m_control_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (Q_UNLIKELY(-1 == this->m_control_fd)) {
+		qErrnoWarning("epoll_create1() failed");
+		abort();
+	}
+
 	this->m_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
 	if (Q_UNLIKELY(-1 == this->m_event_fd)) {
 		qErrnoWarning("eventfd() failed");
 		abort();
 	}
 
+	this->m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (Q_UNLIKELY(-1 == this->m_timer_fd)) {
+		qErrnoWarning("timerfd_create() failed");
+		abort();
+	}
+
+	// Socket notifiers go to m_epoll_fd, everything else goes to m_control_fd, which is nested into m_epoll_fd.
+	// This way ExcludeSocketNotifiers costs nothing: we just wait on m_control_fd instead of m_epoll_fd
 	struct epoll_event e;
-	e.events  = EPOLLIN;
-	e.data.fd = this->m_event_fd;
-	if (Q_UNLIKELY(-1 == epoll_ctl(this->m_epoll_fd, EPOLL_CTL_ADD, this->m_event_fd, &e))) {
+	e.events   = EPOLLIN;
+	e.data.u64 = htEventFd;
+	if (Q_UNLIKELY(-1 == epoll_ctl(this->m_control_fd, EPOLL_CTL_ADD, this->m_event_fd, &e))) {
+		qErrnoWarning("%s: epoll_ctl() failed", Q_FUNC_INFO);
+	}
+
+	e.events   = EPOLLIN;
+	e.data.u64 = htTimerFd;
+	if (Q_UNLIKELY(-1 == epoll_ctl(this->m_control_fd, EPOLL_CTL_ADD, this->m_timer_fd, &e))) {
+		qErrnoWarning("%s: epoll_ctl() failed", Q_FUNC_INFO);
+	}
+
+	e.events   = EPOLLIN;
+	e.data.u64 = htControl;
+	if (Q_UNLIKELY(-1 == epoll_ctl(this->m_epoll_fd, EPOLL_CTL_ADD, this->m_control_fd, &e))) {
 		qErrnoWarning("%s: epoll_ctl() failed", Q_FUNC_INFO);
 	}
 }
 
 EventDispatcherEPollPrivate::~EventDispatcherEPollPrivate(void)
 {
+	if (this->m_group) {
+		this->m_group->removeDispatcher(this->q_ptr);
+	}
+
+#if QT_VERSION >= 0x040400
+	delete this->m_shared_update.fetchAndStoreAcquire(0);
+#endif
+
+	if (-1 != this->m_signal_fd) {
+		epoll_ctl(this->m_epoll_fd, EPOLL_CTL_DEL, this->m_signal_fd, 0);
+		close(this->m_signal_fd);
+	}
+
+	for (int i=0; i<this->m_handles.size(); ++i) {
+		const HandleData* data = this->m_handles.at(i);
+		if (data && data->type == htDescriptor && data->watch.drop) {
+			data->watch.drop(data->watch.context);
+		}
+	}
+
+	for (int i=0; i<this->m_signal_watches.size(); ++i) {
+		const SignalWatch& watch = this->m_signal_watches.at(i);
+		if (watch.callback && watch.drop) {
+			watch.drop(watch.context);
+		}
+	}
+
+	close(this->m_timer_fd);
 	close(this->m_event_fd);
+	close(this->m_control_fd);
 	close(this->m_epoll_fd);
 
-	HandleHash::Iterator it = this->m_handles.begin();
-	while (it != this->m_handles.end()) {
-		delete it.value();
-		++it;
+#if QT_VERSION >= 0x040400
+	PostedTask* task = this->m_tasks.fetchAndStoreAcquire(0);
+	while (task) {
+		PostedTask* next = task->next;
+		if (task->drop) {
+			task->drop(task->context);
+		}
+
+		delete task;
+		task = next;
 	}
+#endif
+
+	// All handles and timers live in the pools and are freed with them
 }
 
 bool EventDispatcherEPollPrivate::processEvents(QEventLoop::ProcessEventsFlags flags)
@@ -56,12 +163,14 @@ bool EventDispatcherEPollPrivate::processEvents(QEventLoop::ProcessEventsFlags f
 	const bool exclude_notifiers = (flags & QEventLoop::ExcludeSocketNotifiers);
 	const bool exclude_timers    = (flags & QEventLoop::X11ExcludeTimers);
 
-	exclude_notifiers && this->disableSocketNotifiers(true);
-	exclude_timers    && this->disableTimers(true);
-
 	this->m_interrupt = false;
 	Q_EMIT q->awake();
 
+	if (Q_UNLIKELY(this->m_stats_enabled)) {
+		++this->m_stats.iterations;
+	}
+
+	// Virtual: subclasses such as EventDispatcherEPollQPA have events of their own to report
 	bool result = q->hasPendingEvents();
 
 #if QT_VERSION < 0x040500
@@ -70,10 +179,14 @@ bool EventDispatcherEPollPrivate::processEvents(QEventLoop::ProcessEventsFlags f
 	QCoreApplication::sendPostedEvents();
 #endif
 
+	// Ready descriptors left over from the previous iteration
+	const bool carried = !exclude_notifiers && this->m_ready_head < this->m_ready.size();
+
 	bool can_wait =
 			!this->m_interrupt
 		 && (flags & QEventLoop::WaitForMoreEvents)
 		 && !result
+		 && !carried
 	;
 
 	int n_events = 0;
@@ -81,76 +194,364 @@ bool EventDispatcherEPollPrivate::processEvents(QEventLoop::ProcessEventsFlags f
 	if (!this->m_interrupt) {
 		int timeout = 0;
 
-		if (!exclude_timers && this->m_zero_timers.size() > 0) {
-			QList<int> ids = this->m_zero_timers.keys();
-
-			for (int i=0; i<ids.size(); ++i) {
-				int tid = ids.at(i);
-				ZeroTimerHash::Iterator it = this->m_zero_timers.find(tid);
-				if (it != this->m_zero_timers.end()) {
-					ZeroTimer& data = it.value();
-					if (data.active) {
-						data.active = false;
-
-						QTimerEvent event(tid);
-						QCoreApplication::sendEvent(data.object, &event);
-						result = true;
-
-						it = this->m_zero_timers.find(tid);
-						if (it != this->m_zero_timers.end()) {
-							ZeroTimer& data = it.value();
-							if (!data.active) {
-								data.active = true;
-							}
-						}
-					}
-				}
+		if (!exclude_timers && (this->m_timers_pending || this->m_expired_head < this->m_expired.size())) {
+			// Some timers expired while timers were excluded, or a timer handler has started this (nested) loop
+			// before the rest of the expired timers have been fired
+			this->activateTimers();
+			result = true;
+		}
+
+		if (!exclude_timers && this->m_zero_first && this->activateZeroTimers()) {
+			result = true;
+		}
+
+		const bool will_block = can_wait && !result;
+		const int epoll_fd    = exclude_notifiers ? this->m_control_fd : this->m_epoll_fd;
+
+		// A nested event loop must not overwrite the events its outer loop is still dispatching
+		const bool nested = this->m_dispatch_depth > 0;
+		QVarLengthArray<struct epoll_event, 64> nested_events(nested ? this->m_events.size() : 0);
+		struct epoll_event* events = nested ? nested_events.data() : this->m_events.data();
+		const int max_events       = this->m_events.size();
+
+		// Descriptors shared or unshared by the group since the last wait change their registrations
+		this->updateSharedDescriptors();
+
+		// Notifiers (un)registered since the last wait reach the kernel in one go, net of changes that cancel out
+		if (!exclude_notifiers && !this->m_changes.isEmpty()) {
+			this->applyChanges();
+		}
+
+		qint64 idle_start = 0;
+		if (will_block && this->m_busy_poll_max) {
+			idle_start = monotonicTime();
+			n_events   = this->busyPoll(epoll_fd, events, max_events, idle_start);
+		}
+
+		if (!n_events) {
+			if (will_block) {
+				Q_EMIT q->aboutToBlock();
+				timeout = this->prepareToSleep() ? -1 : 0;
+			}
+#if QT_VERSION >= 0x040400
+			else if (this->hasPendingEvents()) {
+				// Events posted up to this point have been sent already or are sent when the next iteration starts,
+				// before it can block: the request has been taken care of
+				this->m_wakeups.fetchAndStoreAcquire(0);
+			}
+#endif
+
+			const qint64 wait_start = Q_UNLIKELY(this->m_stats_enabled) ? monotonicTime() : 0;
+
+			do {
+				n_events = epoll_wait(epoll_fd, events, max_events, timeout);
+			} while (Q_UNLIKELY(-1 == n_events && errno == EINTR));
+
+#if QT_VERSION >= 0x040400
+			if (-1 == timeout) {
+				// Whatever has woken the loop up, it is awake now and will see the posted events and tasks
+				this->m_sleeping.fetchAndStoreRelaxed(0);
+				this->m_wakeups.fetchAndStoreAcquire(0);
+			}
+#endif
+
+			if (Q_UNLIKELY(this->m_stats_enabled)) {
+				this->m_stats.blocked_time += monotonicTime() - wait_start;
+				++this->m_stats.epoll_waits;
+				this->m_stats.epoll_events += qMax(n_events, 0);
+			}
+
+			if (idle_start && n_events > 0) {
+				this->updateBusyPollBudget(monotonicTime() - idle_start);
 			}
 		}
 
-		if (can_wait && !result) {
-			Q_EMIT q->aboutToBlock();
-			timeout = -1;
+		// The only clock read of the iteration that timers rely on
+		this->m_now = monotonicClock();
+
+		++this->m_dispatch_depth;
+		if (!this->m_budget_events && !this->m_budget_usec && this->m_ready_head == this->m_ready.size()) {
+			for (int i=0; i<n_events; ++i) {
+				this->dispatchEvent(events[i], exclude_timers);
+			}
+		}
+		else {
+			this->dispatchBudgeted(events, n_events, exclude_notifiers, exclude_timers);
 		}
 
-		struct epoll_event events[1024];
-		do {
-			n_events = epoll_wait(this->m_epoll_fd, events, 1024, timeout);
-		} while (Q_UNLIKELY(-1 == n_events && errno == EINTR));
-
-		for (int i=0; i<n_events; ++i) {
-			struct epoll_event& e = events[i];
-			int fd                = e.data.fd;
-			if (fd == this->m_event_fd) {
-				if (Q_LIKELY(e.events & EPOLLIN)) {
-					this->wake_up_handler();
+		if (0 == --this->m_dispatch_depth) {
+			this->compactReadyQueue();
+			if (!nested) {
+				this->resizeEventBuffer(n_events);
+			}
+		}
+
+#if QT_VERSION >= 0x040400
+		// Tasks are run after the eventfd has been drained: tasks posted from now on wake the loop up again
+		if (this->runPostedTasks()) {
+			result = true;
+		}
+#endif
+	}
+
+	if (Q_UNLIKELY(this->m_stats_enabled)) {
+		this->publishStatistics();
+	}
+
+	return result || carried || n_events > 0;
+}
+
+void EventDispatcherEPollPrivate::dispatchEvent(const struct epoll_event& e, bool exclude_timers)
+{
+	if (e.data.u64 >> 32) {
+		// Events of a handle released by an earlier callback of this batch find nothing, even if the descriptor has been reused
+		HandleData* data = this->liveHandle(e.data.u64);
+		if (data) {
+			if (data->type == htDescriptor) {
+				this->descriptor_callback(data, e.events);
+			}
+			else {
+				if (Q_UNLIKELY(this->m_stats_enabled)) {
+					this->countSocketEvents(data->sni, e.events);
 				}
+
+				this->socket_notifier_callback(e.data.u64, e.events);
+			}
+		}
+
+		return;
+	}
+
+	switch (static_cast<HandleType>(e.data.u64)) {
+		case htControl:
+			this->control_handler(exclude_timers);
+			break;
+
+		case htEventFd:
+			if (Q_LIKELY(e.events & EPOLLIN)) {
+				this->wake_up_handler();
+			}
+
+			break;
+
+		case htTimerFd:
+			if (Q_LIKELY(!exclude_timers)) {
+				this->timer_callback();
 			}
 			else {
-				HandleHash::ConstIterator it = this->m_handles.find(fd);
-				if (Q_LIKELY(it != this->m_handles.constEnd())) {
-					HandleData* data = it.value();
-					switch (data->type) {
-						case htSocketNotifier:
-							EventDispatcherEPollPrivate::socket_notifier_callback(data->sni, e.events);
-							break;
-
-						case htTimer:
-							this->timer_callback(data->ti);
-							break;
-
-						default:
-							Q_UNREACHABLE();
-					}
+				// Expired timers stay where they are until timers are no longer excluded
+				this->drainTimerFd();
+				this->m_timers_pending = true;
+			}
+
+			break;
+
+		case htSignalFd:
+			this->signal_handler();
+			break;
+
+		default:
+			Q_UNREACHABLE();
+	}
+}
+
+void EventDispatcherEPollPrivate::control_handler(bool exclude_timers)
+{
+	struct epoll_event events[4];
+	int n;
+
+	do {
+		n = epoll_wait(this->m_control_fd, events, 4, 0);
+	} while (Q_UNLIKELY(-1 == n && errno == EINTR));
+
+	if (Q_UNLIKELY(this->m_stats_enabled)) {
+		++this->m_stats.epoll_waits;
+		this->m_stats.epoll_events += qMax(n, 0);
+	}
+
+	for (int i=0; i<n; ++i) {
+		this->dispatchEvent(events[i], exclude_timers);
+	}
+}
+
+void EventDispatcherEPollPrivate::dispatchBudgeted(const struct epoll_event* events, int n, bool exclude_notifiers, bool exclude_timers)
+{
+	// Timers and wakeups are never deferred; socket events join the ready queue behind the ones carried over,
+	// so that every ready descriptor gets its turn no matter where the kernel reports it
+	for (int i=0; i<n; ++i) {
+		const quint64 key = events[i].data.u64;
+		if (!(key >> 32)) {
+			this->dispatchEvent(events[i], exclude_timers);
+		}
+		else {
+			HandleData* data = this->liveHandle(key);
+			if (data) {
+				if (!data->pending) {
+					this->m_ready.append(key);
+				}
+
+				data->pending |= events[i].events;
+			}
+		}
+	}
+
+	if (exclude_notifiers) {
+		return;
+	}
+
+	const qint64 deadline = this->m_budget_usec ? monotonicTime() + this->m_budget_usec : 0;
+	int count = 0;
+
+	// Nested event loops serve the same queue, m_ready_head is re-read after every callback
+	while (this->m_ready_head < this->m_ready.size()) {
+		if (count && ((this->m_budget_events && count >= this->m_budget_events) || (deadline && monotonicTime() >= deadline))) {
+			break;
+		}
+
+		// The handle could have been released (and its descriptor possibly reused) since it was queued
+		const quint64 key = this->m_ready.at(this->m_ready_head++);
+		HandleData* data  = this->liveHandle(key);
+		if (data && data->pending) {
+			uint pending  = data->pending;
+			data->pending = 0;
+
+			if (data->type == htDescriptor) {
+				this->descriptor_callback(data, pending);
+			}
+			else {
+				if (Q_UNLIKELY(this->m_stats_enabled)) {
+					this->countSocketEvents(data->sni, pending);
 				}
+
+				this->socket_notifier_callback(key, pending);
 			}
+
+			++count;
+		}
+	}
+}
+
+void EventDispatcherEPollPrivate::compactReadyQueue(void)
+{
+	if (this->m_ready_head == this->m_ready.size()) {
+		this->m_ready.resize(0);
+	}
+	else if (this->m_ready_head > 0) {
+		this->m_ready.remove(0, this->m_ready_head);
+	}
+
+	this->m_ready_head = 0;
+}
+
+void EventDispatcherEPollPrivate::resizeEventBuffer(int n_events)
+{
+	const int size = this->m_events.size();
+
+	// A full buffer means more descriptors could be ready
+	if (n_events >= size) {
+		if (size < 65536) {
+			this->m_events.resize(2 * size);
+		}
+
+		this->m_events_peak   = 0;
+		this->m_events_window = 0;
+		return;
+	}
+
+	this->m_events_peak = qMax(this->m_events_peak, n_events);
+	if (++this->m_events_window == 1024) {
+		if (size > 64 && this->m_events_peak < size / 4) {
+			this->m_events.resize(size / 2);
+			this->m_events.squeeze();
 		}
+
+		this->m_events_peak   = 0;
+		this->m_events_window = 0;
+	}
+}
+
+int EventDispatcherEPollPrivate::busyPoll(int epoll_fd, struct epoll_event* events, int max, qint64 start)
+{
+	const qint64 budget = this->m_busy_poll_budget;
+	if (!budget) {
+		return 0;
+	}
+
+	int n;
+	qint64 now;
+	do {
+		n = epoll_wait(epoll_fd, events, max, 0);
+		if (Q_UNLIKELY(this->m_stats_enabled)) {
+			++this->m_stats.epoll_waits;
+			this->m_stats.epoll_events += qMax(n, 0);
+		}
+
+		now = monotonicTime();
+#if QT_VERSION >= 0x050000
+	} while (n <= 0 && now - start < budget && !this->m_wakeups.load());
+#elif QT_VERSION >= 0x040400
+	} while (n <= 0 && now - start < budget && !static_cast<int>(this->m_wakeups));
+#else
+	} while (n <= 0 && now - start < budget);
+#endif
+
+	n = qMax(n, 0);
+	if (n) {
+		this->updateBusyPollBudget(now - start);
+	}
+
+	if (Q_UNLIKELY(this->m_stats_enabled)) {
+		// Polling that has been cut short by a wakeUp() request has spared the loop the wait all the same
+		++((n || now - start < budget) ? this->m_stats.busy_poll_hits : this->m_stats.busy_poll_misses);
+		this->m_stats.busy_poll_time += now - start;
+	}
+
+	return n;
+}
+
+void EventDispatcherEPollPrivate::updateBusyPollBudget(qint64 idle)
+{
+	this->m_idle_average += (idle - this->m_idle_average) / 8;
+
+	// Polling pays off only if the next event is likely to arrive before the budget runs out;
+	// otherwise it just burns CPU time before blocking anyway
+	if (this->m_idle_average > this->m_busy_poll_max) {
+		this->m_busy_poll_budget = 0;
+	}
+	else {
+		this->m_busy_poll_budget = qBound(Q_INT64_C(1), 2 * this->m_idle_average, this->m_busy_poll_max);
+	}
+
+	// The kernel would otherwise keep polling the network devices in every blocking wait of an idle thread
+	if ((this->m_busy_poll_budget != 0) != this->m_kernel_busy_poll) {
+		this->setKernelBusyPolling(this->m_busy_poll_budget != 0);
 	}
+}
 
-	exclude_notifiers && this->disableSocketNotifiers(false);
-	exclude_timers    && this->disableTimers(false);
+void EventDispatcherEPollPrivate::setBusyPolling(int max_usec)
+{
+	this->m_busy_poll_max    = max_usec;
+	this->m_busy_poll_budget = max_usec;
+	this->m_idle_average     = max_usec / 2;
+	this->setKernelBusyPolling(max_usec != 0);
+}
 
-	return result || n_events > 0;
+void EventDispatcherEPollPrivate::setKernelBusyPolling(bool enable)
+{
+	this->m_kernel_busy_poll = enable;
+
+	struct epoll_params params;
+	memset(&params, 0, sizeof(params));
+	if (enable) {
+		params.busy_poll_usecs  = static_cast<quint32>(this->m_busy_poll_max);
+		params.busy_poll_budget = 8; // BUSY_POLL_BUDGET, larger values require CAP_NET_ADMIN
+	}
+
+	// Older kernels do not know this ioctl (ENOTTY), kernels without CONFIG_NET_RX_BUSY_POLL reject it (EOPNOTSUPP);
+	// busy polling in user space works regardless
+	if (-1 == ioctl(this->m_epoll_fd, EPIOCSPARAMS, &params) && ENOTTY != errno && EOPNOTSUPP != errno) {
+		qErrnoWarning("%s: ioctl(EPIOCSPARAMS) failed", Q_FUNC_INFO);
+	}
 }
 
 void EventDispatcherEPollPrivate::wake_up_handler(void)
@@ -161,23 +562,134 @@ void EventDispatcherEPollPrivate::wake_up_handler(void)
 		res = eventfd_read(this->m_event_fd, &value);
 	} while (Q_UNLIKELY(-1 == res && EINTR == errno));
 
-	if (Q_UNLIKELY(-1 == res)) {
+	// EAGAIN: a nested event loop has already drained the eventfd
+	if (Q_UNLIKELY(-1 == res && EAGAIN != errno)) {
 		qErrnoWarning("%s: eventfd_read() failed", Q_FUNC_INFO);
 	}
+}
+
+void EventDispatcherEPollPrivate::releaseContext(void (*drop)(void*), void* context)
+{
+	if (!drop) {
+		return;
+	}
+
+	// A callback may remove or replace itself; its context must outlive the call
+	if (this->m_callback_depth) {
+		CallbackContext dead;
+		dead.drop    = drop;
+		dead.context = context;
+		this->m_dead_contexts.append(dead);
+	}
+	else {
+		drop(context);
+	}
+}
+
+void EventDispatcherEPollPrivate::leaveCallbacks(void)
+{
+	if (0 == --this->m_callback_depth && !this->m_dead_contexts.isEmpty()) {
+		QVector<CallbackContext> dead = this->m_dead_contexts;
+		this->m_dead_contexts.clear();
+		for (int i=0; i<dead.size(); ++i) {
+			dead.at(i).drop(dead.at(i).context);
+		}
+	}
+}
 
 #if QT_VERSION >= 0x040400
-	if (Q_UNLIKELY(!this->m_wakeups.testAndSetRelease(1, 0))) {
-		qCritical("%s: internal error, testAndSetRelease(1, 0) failed!", Q_FUNC_INFO);
+void EventDispatcherEPollPrivate::postTask(EventDispatcherEPoll::TaskFunction run, EventDispatcherEPoll::TaskFunction drop, void* context)
+{
+	PostedTask* task = new PostedTask;
+	task->run        = run;
+	task->drop       = drop;
+	task->context    = context;
+
+	// Push onto the stack; the consumer always takes the whole stack at once, so ABA cannot happen
+	PostedTask* head;
+	do {
+#if QT_VERSION >= 0x050000
+		head = this->m_tasks.load();
+#else
+		head = this->m_tasks;
+#endif
+		task->next = head;
+	} while (!this->m_tasks.testAndSetRelease(head, task));
+
+	// Only the task that makes the stack non-empty needs to wake the loop up
+	if (!head) {
+		this->wakeup();
 	}
+}
+
+bool EventDispatcherEPollPrivate::runPostedTasks(void)
+{
+#if QT_VERSION >= 0x050000
+	if (!this->m_tasks.load()) {
+#else
+	if (!static_cast<PostedTask*>(this->m_tasks)) {
 #endif
+		return false;
+	}
+
+	PostedTask* task = this->m_tasks.fetchAndStoreAcquire(0);
+
+	// The stack has the newest task on top
+	PostedTask* fifo = 0;
+	while (task) {
+		PostedTask* next = task->next;
+		task->next       = fifo;
+		fifo             = task;
+		task             = next;
+	}
+
+	while (fifo) {
+		task = fifo;
+		fifo = fifo->next;
+		task->run(task->context);
+		delete task;
+	}
+
+	return true;
+}
+#endif
+
+bool EventDispatcherEPollPrivate::prepareToSleep(void)
+{
+#if QT_VERSION >= 0x040400
+	this->m_sleeping.fetchAndStoreOrdered(1);
+
+	// Tasks pushed onto a non-empty stack do not call wakeup(), so the stack is checked too
+#	if QT_VERSION >= 0x050000
+	if (this->m_wakeups.fetchAndStoreOrdered(0) || this->m_tasks.load()) {
+#	else
+	if (this->m_wakeups.fetchAndStoreOrdered(0) || static_cast<PostedTask*>(this->m_tasks)) {
+#	endif
+		this->m_sleeping.fetchAndStoreRelaxed(0);
+		return false;
+	}
+#endif
+
+	return true;
 }
 
 void EventDispatcherEPollPrivate::wakeup(void)
 {
 #if QT_VERSION >= 0x040400
-	if (this->m_wakeups.testAndSetAcquire(0, 1))
+	// Counted even while the statistics are disabled: m_stats_enabled belongs to the dispatcher's thread,
+	// and enabling the statistics resets the counters anyway
+	this->m_stats_wakeups_requested.fetchAndAddRelaxed(1);
+
+	// Only the first request since the loop has last noticed one matters, and it costs a syscall only if the loop
+	// is blocked: a running loop checks m_wakeups in prepareToSleep(). Both sides use full barriers, so at least
+	// one of them sees the other's store
+	if (0 == this->m_wakeups.fetchAndStoreOrdered(1) && this->m_sleeping.fetchAndAddOrdered(0))
 #endif
 	{
+#if QT_VERSION >= 0x040400
+		this->m_stats_wakeups_written.fetchAndAddRelaxed(1);
+#endif
+
 		const eventfd_t value = 1;
 		int res;
 
@@ -190,3 +702,133 @@ void EventDispatcherEPollPrivate::wakeup(void)
 		}
 	}
 }
+
+EventDispatcherEPoll::PoolStatistics EventDispatcherEPollPrivate::poolStatistics(void) const
+{
+	EventDispatcherEPoll::PoolStatistics res;
+	res.handles                = this->m_handle_pool.inUse();
+	res.handles_high_water     = this->m_handle_pool.highWater();
+	res.timers                 = this->m_timer_pool.inUse();
+	res.timers_high_water      = this->m_timer_pool.highWater();
+	res.timer_slots            = this->m_slot_pool.inUse();
+	res.timer_slots_high_water = this->m_slot_pool.highWater();
+	res.zero_timers            = this->m_zero_timer_pool.inUse();
+	res.zero_timers_high_water = this->m_zero_timer_pool.highWater();
+	return res;
+}
+
+void EventDispatcherEPollPrivate::deliverTimedEvent(QObject* receiver, QEvent* e, EventDispatcherEPoll::SlowHandlerReport::Kind kind, int id)
+{
+	// The handler can delete the receiver (or the dispatcher can be reconfigured), save everything we need beforehand
+	const EventDispatcherEPoll::SlowHandlerCallback callback = this->m_watchdog_callback;
+	void* const context  = this->m_watchdog_context;
+	const qint64 budget  = this->m_watchdog_budget;
+	const char* name     = receiver->metaObject()->className();
+	QString object_name  = receiver->objectName();
+
+	const qint64 start = monotonicTime();
+	QCoreApplication::sendEvent(receiver, e);
+	const qint64 duration = monotonicTime() - start;
+
+	if (Q_UNLIKELY(duration > budget)) {
+		EventDispatcherEPoll::SlowHandlerReport report;
+		report.kind       = kind;
+		report.id         = id;
+		report.duration   = duration;
+		report.className  = name;
+		report.objectName = object_name;
+		callback(report, context);
+	}
+}
+
+void EventDispatcherEPollPrivate::setStatisticsEnabled(bool enable)
+{
+	if (enable && !this->m_stats_enabled) {
+		memset(&this->m_stats, 0, sizeof(this->m_stats));
+		this->m_stats_start = monotonicTime();
+#if QT_VERSION >= 0x040400
+		this->m_stats_wakeups_requested.fetchAndStoreRelaxed(0);
+		this->m_stats_wakeups_written.fetchAndStoreRelaxed(0);
+#endif
+		this->m_stats_enabled = true;
+		this->publishStatistics();
+	}
+	else {
+		this->m_stats_enabled = enable;
+	}
+}
+
+void EventDispatcherEPollPrivate::publishStatistics(void)
+{
+	const qint64 elapsed     = monotonicTime() - this->m_stats_start;
+	this->m_stats.busy_time  = qMax(elapsed - qint64(this->m_stats.blocked_time), Q_INT64_C(0));
+
+#if QT_VERSION >= 0x040400
+	// Collect what other threads have counted since the last iteration
+	this->m_stats.wakeups_requested += uint(this->m_stats_wakeups_requested.fetchAndStoreRelaxed(0));
+	this->m_stats.wakeups_written   += uint(this->m_stats_wakeups_written.fetchAndStoreRelaxed(0));
+
+	this->m_stats_seq.fetchAndAddOrdered(1);
+	this->m_stats_copy = this->m_stats;
+	this->m_stats_seq.fetchAndAddRelease(1);
+#else
+	this->m_stats_copy = this->m_stats;
+#endif
+}
+
+EventDispatcherEPoll::Statistics EventDispatcherEPollPrivate::statistics(void) const
+{
+	EventDispatcherEPoll::Statistics res;
+
+#if QT_VERSION >= 0x040400
+	for (;;) {
+		int seq = this->m_stats_seq.fetchAndAddAcquire(0);
+		if (Q_UNLIKELY(seq & 1)) {
+			// The dispatcher is publishing a new snapshot right now
+			sched_yield();
+			continue;
+		}
+
+		res = this->m_stats_copy;
+		if (Q_LIKELY(this->m_stats_seq.fetchAndAddOrdered(0) == seq)) {
+			break;
+		}
+	}
+#else
+	res = this->m_stats_copy;
+#endif
+
+	return res;
+}
+
+void EventDispatcherEPollPrivate::countSocketEvents(const SocketNotifierInfo& n, uint events)
+{
+	if (n.r && (events & EPOLLIN)) {
+		++this->m_stats.read_events;
+	}
+
+	if (n.w && (events & EPOLLOUT)) {
+		++this->m_stats.write_events;
+	}
+
+	if (n.x && (events & EPOLLPRI)) {
+		++this->m_stats.exception_events;
+	}
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		++this->m_stats.error_events;
+	}
+}
+
+void EventDispatcherEPollPrivate::countTimerEvent(const TimerInfo* info, qint64 now)
+{
+	++this->m_stats.timer_events[info->type];
+
+	if (now > info->deadline) {
+		quint64 lateness = quint64(now - info->deadline) / 1000;
+		this->m_stats.timer_lateness += lateness;
+		if (lateness > this->m_stats.timer_max_lateness) {
+			this->m_stats.timer_max_lateness = lateness;
+		}
+	}
+}
@@ -3,53 +3,159 @@
 
 #include <qplatformdefs.h>
 #include <QtCore/QAbstractEventDispatcher>
-#include <QtCore/QHash>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QVector>
+#include <sys/epoll.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
 
 #if QT_VERSION >= 0x040400
 #	include <QtCore/QAtomicInt>
+#	include <QtCore/QAtomicPointer>
 #endif
 
+#include "eventdispatcher_epoll.h"
+#include "objectpool_p.h"
 #include "qt4compat.h"
 
 enum HandleType {
-	htTimer,
-	htSocketNotifier
+	htSocketNotifier,
+	htControl,
+	htEventFd,
+	htTimerFd,
+	htSignalFd,
+	htDescriptor
+};
+
+struct DescriptorWatch {
+	EventDispatcherEPoll::DescriptorCallback callback;
+	void (*drop)(void* context);             // releases the context when the watcher is removed, may be 0
+	void* context;
 };
 
 struct SocketNotifierInfo {
 	QSocketNotifier* r;
 	QSocketNotifier* w;
 	QSocketNotifier* x;
-	int events;
+	uint events;             // includes EPOLLET for edge-triggered descriptors, EPOLLEXCLUSIVE for shared ones
 };
 
+struct TimerSlot;
+
+// Timer times are CLOCK_MONOTONIC nanoseconds, the clock of the timer fd and of io_uring timeouts
 struct TimerInfo {
 	QObject* object;
-	struct timeval when;
+	qint64 when;             // nominal expiration time
+	qint64 deadline;         // when the timer actually fires (after coarse rounding)
+	qint64 interval;         // nanoseconds; only precise timers can have sub-millisecond intervals
 	int timerId;
-	int interval;
-	int fd;
+	int overruns;            // precise timers: expirations coalesced into the last timer event
+	int index;               // position in the timer heap (precise timers), -1 if not there
 	Qt::TimerType type;
+	TimerSlot* slot;         // coarse timers: the slot the timer is linked into, 0 if not there
+	TimerInfo* prev;
+	TimerInfo* next;
+	bool expired;            // detached from the heap and the slots, waiting in m_expired for its event
+	bool firing;             // the handler is running; the timer is scheduled again when it returns
+};
+
+// All coarse and very coarse timers expiring at the same (rounded) moment
+struct TimerSlot {
+	qint64 deadline;
+	qint64 key;              // deadline in milliseconds
+	int index;               // position in the slot heap
+	TimerInfo* first;
+	TimerInfo* last;
+	TimerSlot* hash_next;    // next slot in the same bucket of the slot hash
 };
 
 struct ZeroTimer {
 	QObject* object;
-	bool active;
+	ZeroTimer* prev;
+	ZeroTimer* next;
+	quint64 generation;      // the dispatch pass that has fired the timer last, or the one it was registered during
+	int timerId;
+	bool firing;             // the handler is running
+	bool dead;               // unregistered during a dispatch pass, unlinked when the pass is over
 };
 
 struct HandleData {
 	HandleType type;
-	union {
-		SocketNotifierInfo sni;
-		TimerInfo ti;
-	};
+	int fd;
+	quint32 generation;      // tells the handle from earlier and later handles for the same descriptor, never 0
+	uint pending;            // events waiting in the ready queue; 0 if the handle is not queued or its events have been dropped
+	uint registered;         // socket notifiers: the events the kernel has, 0 if the descriptor has not been added yet
+	bool changed;            // socket notifiers: the interest set has changed, the descriptor is in the changelist
+	bool rearm;              // socket notifiers: an edge-triggered notifier has been re-enabled
+	SocketNotifierInfo sni;  // descriptor watchers keep their interest set in sni.events and have no notifiers
+	DescriptorWatch watch;   // descriptor watchers only
+};
+
+#if QT_VERSION >= 0x040400
+struct PostedTask {
+	PostedTask* next;
+	EventDispatcherEPoll::TaskFunction run;
+	EventDispatcherEPoll::TaskFunction drop; // releases the context of a task that will never run, may be 0
+	void* context;
+};
+#endif
+
+struct SignalWatch {
+	EventDispatcherEPoll::SignalCallback callback; // 0 if the signal is not watched
+	void (*drop)(void* context);                   // releases the context when the watch is removed, may be 0
+	void* context;
+};
+
+// The context of a callback that has been removed while callbacks were running
+struct CallbackContext {
+	void (*drop)(void* context);
+	void* context;
 };
 
 Q_DECLARE_TYPEINFO(SocketNotifierInfo, Q_PRIMITIVE_TYPE);
 Q_DECLARE_TYPEINFO(TimerInfo, Q_PRIMITIVE_TYPE);
 Q_DECLARE_TYPEINFO(HandleData, Q_PRIMITIVE_TYPE);
+Q_DECLARE_TYPEINFO(SignalWatch, Q_PRIMITIVE_TYPE);
+Q_DECLARE_TYPEINFO(CallbackContext, Q_PRIMITIVE_TYPE);
+Q_DECLARE_TYPEINFO(epoll_event, Q_PRIMITIVE_TYPE);
+
+// epoll_event::data of a handle: the generation in the upper half, the descriptor in the lower half.
+// The dispatcher's own descriptors have generation 0 and their HandleType in the lower half
+static inline quint64 handleKey(const HandleData* data)
+{
+	return (quint64(data->generation) << 32) | quint32(data->fd);
+}
+
+template<typename T>
+static inline void growTable(QVector<T*>& table, int idx)
+{
+	if (idx >= table.size()) {
+		int size = table.size();
+		table.resize(qMax(idx + 1, 2 * size));
+		for (int i=size; i<table.size(); ++i) {
+			table[i] = 0;
+		}
+	}
+}
 
-class EventDispatcherEPoll;
+static inline qint64 monotonicClock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return qint64(ts.tv_sec) * Q_INT64_C(1000000000) + ts.tv_nsec;
+}
+
+// Qt timer intervals are whole milliseconds; sub-millisecond ones are rounded up
+static inline int timerIntervalMsec(const TimerInfo* info)
+{
+	return static_cast<int>(qMin((info->interval + 999999) / 1000000, qint64(INT_MAX)));
+}
+
+// Computes info->when and info->deadline for the next expiration; shared with the io_uring backend
+void calculateNextTimeout(TimerInfo* info, qint64 now);
+
+class EventDispatcherEPollGroup;
 
 class Q_DECL_HIDDEN EventDispatcherEPollPrivate {
 public:
@@ -58,41 +164,185 @@ public:
 	bool processEvents(QEventLoop::ProcessEventsFlags flags);
 	void registerSocketNotifier(QSocketNotifier* notifier);
 	void unregisterSocketNotifier(QSocketNotifier* notifier);
-	void registerTimer(int timerId, int interval, Qt::TimerType type, QObject* object);
+	void registerTimer(int timerId, qint64 interval, Qt::TimerType type, QObject* object);
 	void registerZeroTimer(int timerId, QObject* object);
 	bool unregisterTimer(int timerId);
 	bool unregisterTimers(QObject* object);
 	QList<QAbstractEventDispatcher::TimerInfo> registeredTimers(QObject* object) const;
 	int remainingTime(int timerId) const;
+	int timerOverruns(int timerId) const;
 	void wakeup(void);
+	EventDispatcherEPoll::PoolStatistics poolStatistics(void) const;
+	void setStatisticsEnabled(bool enable);
+#if QT_VERSION >= 0x040400
+	// QCoreApplication::postEvent() calls wakeUp() on the receiver's dispatcher, so a pending wakeup request
+	// means there are events posted to this thread (qGlobalPostedEventsCount() counts those of all threads)
+	bool hasPendingEvents(void) const
+	{
+#	if QT_VERSION >= 0x050000
+		return this->m_wakeups.load() != 0;
+#	else
+		return static_cast<int>(this->m_wakeups) != 0;
+#	endif
+	}
 
-	typedef QHash<int, HandleData*> HandleHash;
-	typedef QHash<int, HandleData*> TimerHash;
-	typedef QHash<QSocketNotifier*, HandleData*> SocketNotifierHash;
-	typedef QHash<int, ZeroTimer> ZeroTimerHash;
+	void postTask(EventDispatcherEPoll::TaskFunction run, EventDispatcherEPoll::TaskFunction drop, void* context);
+#endif
+	void setBusyPolling(int max_usec);
+	EventDispatcherEPoll::Statistics statistics(void) const;
+	bool watchSignal(int signo, EventDispatcherEPoll::SignalCallback callback, void (*drop)(void*), void* context);
+	void unwatchSignal(int signo);
+	bool watchDescriptor(int fd, uint events, EventDispatcherEPoll::DescriptorCallback callback, void (*drop)(void*), void* context);
+	bool setDescriptorEvents(int fd, uint events);
+	void unwatchDescriptor(int fd);
+
+	typedef QVector<HandleData*> HandleTable;
+	typedef QVector<TimerInfo*> TimerTable;
+	typedef QVector<TimerInfo*> TimerHeap;
+	typedef QVector<TimerSlot*> TimerSlotHash;
+	typedef QVector<TimerSlot*> TimerSlotHeap;
+	typedef QVector<ZeroTimer*> ZeroTimerTable;
 
 private:
 	Q_DISABLE_COPY(EventDispatcherEPollPrivate)
 	Q_DECLARE_PUBLIC(EventDispatcherEPoll)
 	EventDispatcherEPoll* const q_ptr;
+	friend class EventDispatcherEPollGroup;
 
 	int m_epoll_fd;
+	int m_control_fd;
 	int m_event_fd;
+	int m_timer_fd;
+	EventDispatcherEPollGroup* m_group;
+	QVector<int> m_shared;     // the group's shared descriptors, sorted; read and written by the dispatcher's thread only
+#if QT_VERSION >= 0x040400
+	QAtomicPointer<QVector<int> > m_shared_update; // a newer set published by the group, taken over by updateSharedDescriptors()
+#endif
 	bool m_interrupt;
+	bool m_edge_triggered;
+	bool m_timers_pending;
+	bool m_timer_armed;
+	qint64 m_timer_deadline;
+	qint64 m_timer_interval;   // the period the timer fd is armed with, 0 if it is a one shot timer
+	qint64 m_now;              // monotonic time, refreshed once per iteration after epoll_wait() and when timers are registered
+	qint64 m_precise_interval; // nanoseconds, passes the interval from registerPreciseTimer() to registerTimer()
 #if QT_VERSION >= 0x040400
-	QAtomicInt m_wakeups;
+	QAtomicInt m_wakeups;  // set by wakeup(), cleared when the loop has noticed the request
+	QAtomicInt m_sleeping; // set while the loop is (about to be) blocked in epoll_wait()
+	QAtomicPointer<PostedTask> m_tasks; // posted tasks, newest first
 #endif
-	HandleHash m_handles;
-	SocketNotifierHash m_notifiers;
-	TimerHash m_timers;
-	ZeroTimerHash m_zero_timers;
+	bool m_stats_enabled;                          // read and written by the dispatcher's thread only
+	qint64 m_stats_start;                          // monotonic time the statistics were enabled at
+	EventDispatcherEPoll::Statistics m_stats;      // updated by the dispatcher's thread only
+	EventDispatcherEPoll::Statistics m_stats_copy; // published at the end of every iteration
+#if QT_VERSION >= 0x040400
+	mutable QAtomicInt m_stats_seq;                // seqlock guarding m_stats_copy, odd while it is being written
+	QAtomicInt m_stats_wakeups_requested;          // wakeUp() may be called from any thread, counts even with the statistics off
+	QAtomicInt m_stats_wakeups_written;
+#endif
+	qint64 m_watchdog_budget; // microseconds, 0 when the watchdog is off
+	EventDispatcherEPoll::SlowHandlerCallback m_watchdog_callback;
+	void* m_watchdog_context;
+	qint64 m_busy_poll_max;    // microseconds, 0 when busy polling is off
+	qint64 m_busy_poll_budget; // how long to poll before blocking, adapts to m_idle_average
+	qint64 m_idle_average;     // moving average of the time the event loop waits for events
+	bool m_kernel_busy_poll;   // whether EPIOCSPARAMS has enabled in-kernel busy polling, follows m_busy_poll_budget
+	ObjectPool<HandleData> m_handle_pool;
+	ObjectPool<TimerInfo> m_timer_pool;
+	ObjectPool<TimerSlot> m_slot_pool;
+	ObjectPool<ZeroTimer> m_zero_timer_pool;
+	HandleTable m_handles; // indexed by file descriptor
+	quint32 m_generation;  // of the last handle allocated
+	QVector<int> m_changes; // descriptors whose interest sets are to be brought to the kernel before the next epoll_wait()
+	int m_dispatch_depth;
+	QVector<struct epoll_event> m_events; // epoll_wait() buffer of the outermost event loop, sized to fit the load
+	int m_events_peak;                    // most events returned by one epoll_wait() in the current window
+	int m_events_window;                  // iterations in the current window
+	int m_budget_events;                  // socket notifier activations per iteration, 0 if unlimited
+	int m_budget_usec;
+	QVector<quint64> m_ready;             // keys of the handles with pending events, served in order
+	int m_ready_head;                     // the first entry of m_ready still to be served
+	TimerTable m_timers;   // indexed by timer ID
+	TimerHeap m_timer_heap;
+	QVector<int> m_expired; // IDs of the expired timers still to be fired, shared with nested event loops
+	int m_expired_head;     // the first entry of m_expired still to be served
+	TimerSlotHash m_slots; // intrusive hash, the number of buckets is a power of two
+	int m_slot_count;
+	TimerSlotHeap m_slot_heap;
+	ZeroTimerTable m_zero_timers; // indexed by timer ID
+	ZeroTimer* m_zero_first;
+	ZeroTimer* m_zero_last;
+	quint64 m_zero_generation;
+	int m_zero_dispatch_depth;
+	int m_zero_dead;              // dead zero timers waiting to be unlinked
+	int m_signal_fd;              // -1 while no signals are watched
+	sigset_t m_signal_mask;       // the signals the signalfd accepts
+	QVector<SignalWatch> m_signal_watches; // indexed by signal number
+	QVector<CallbackContext> m_dead_contexts; // released when the signal and descriptor callbacks return
+	int m_callback_depth;                     // signal and descriptor callbacks running
 
-	static void socket_notifier_callback(const SocketNotifierInfo& n, int events);
-	void timer_callback(const TimerInfo& info);
+	void socket_notifier_callback(quint64 key, uint events);
+	void dispatchEvent(const struct epoll_event& e, bool exclude_timers);
+	void control_handler(bool exclude_timers);
+	void dispatchBudgeted(const struct epoll_event* events, int n, bool exclude_notifiers, bool exclude_timers);
+	void compactReadyQueue(void);
+	void resizeEventBuffer(int n_events);
+	int busyPoll(int epoll_fd, struct epoll_event* events, int max, qint64 start);
+	void updateBusyPollBudget(qint64 idle);
+	void setKernelBusyPolling(bool enable);
+	void timer_callback(void);
+	void activateTimers(void);
 	void wake_up_handler(void);
+	void signal_handler(void);
+	void descriptor_callback(HandleData* data, uint events);
+	void releaseContext(void (*drop)(void*), void* context);
+	void leaveCallbacks(void);
+	bool runPostedTasks(void);
+	bool prepareToSleep(void);
+
+	inline void deliverEvent(QObject* receiver, QEvent* e, EventDispatcherEPoll::SlowHandlerReport::Kind kind, int id)
+	{
+		if (Q_LIKELY(!this->m_watchdog_budget)) {
+			QCoreApplication::sendEvent(receiver, e);
+		}
+		else {
+			this->deliverTimedEvent(receiver, e, kind, id);
+		}
+	}
+
+	void deliverTimedEvent(QObject* receiver, QEvent* e, EventDispatcherEPoll::SlowHandlerReport::Kind kind, int id);
+
+	void publishStatistics(void);
+	void countSocketEvents(const SocketNotifierInfo& n, uint events);
+	void countTimerEvent(const TimerInfo* info, qint64 now);
+
+	HandleData* handle(int fd) const;
+	HandleData* liveHandle(quint64 key) const;
+	HandleData* allocateHandle(HandleType type, int fd);
+	int epollCtl(int op, int fd, struct epoll_event* e);
+	int updateHandle(HandleData* data);
+	void queueChange(HandleData* data);
+	void applyChanges(void);
+	void updateSharedDescriptors(void);
+	void releaseHandle(int fd, HandleData* data);
+
+	void drainTimerFd(void);
+
+	TimerInfo* timer(int timerId) const;
+	ZeroTimer* zeroTimer(int timerId) const;
+	void unregisterZeroTimer(ZeroTimer* data);
+	void unlinkZeroTimer(ZeroTimer* data);
+	bool activateZeroTimers(void);
+	void sweepZeroTimers(void);
+
+	TimerSlot* findSlot(qint64 key) const;
+	void insertSlot(TimerSlot* slot);
+	void removeSlot(TimerSlot* slot);
 
-	bool disableSocketNotifiers(bool disable);
-	bool disableTimers(bool disable);
+	void scheduleTimer(TimerInfo* info);
+	void unscheduleTimer(TimerInfo* info);
+	const qint64* nextDeadline(void) const;
+	void rearmTimer(void);
 };
 
 #endif // EVENTDISPATCHER_EPOLL_P_H
@@ -0,0 +1,180 @@
+#include <QtCore/QPair>
+#include <QtCore/QSocketNotifier>
+#include <QtCore/QThread>
+#include "eventdispatcher_iouring.h"
+#include "eventdispatcher_iouring_p.h"
+
+EventDispatcherIOUring::EventDispatcherIOUring(QObject* parent)
+	: QAbstractEventDispatcher(parent), d_ptr(new EventDispatcherIOUringPrivate(this))
+{
+}
+
+EventDispatcherIOUring::~EventDispatcherIOUring(void)
+{
+#if QT_VERSION < 0x040600
+	delete this->d_ptr;
+	this->d_ptr = 0;
+#endif
+}
+
+bool EventDispatcherIOUring::processEvents(QEventLoop::ProcessEventsFlags flags)
+{
+	Q_D(EventDispatcherIOUring);
+	return d->processEvents(flags);
+}
+
+bool EventDispatcherIOUring::hasPendingEvents(void)
+{
+	extern uint qGlobalPostedEventsCount();
+	return qGlobalPostedEventsCount() > 0;
+}
+
+void EventDispatcherIOUring::registerSocketNotifier(QSocketNotifier* notifier)
+{
+#ifndef QT_NO_DEBUG
+	if (notifier->socket() < 0) {
+		qWarning("QSocketNotifier: Internal error: sockfd < 0");
+		return;
+	}
+
+	if (notifier->thread() != thread() || thread() != QThread::currentThread()) {
+		qWarning("QSocketNotifier: socket notifiers cannot be enabled from another thread");
+		return;
+	}
+#endif
+
+	Q_D(EventDispatcherIOUring);
+	d->registerSocketNotifier(notifier);
+}
+
+void EventDispatcherIOUring::unregisterSocketNotifier(QSocketNotifier* notifier)
+{
+#ifndef QT_NO_DEBUG
+	if (notifier->socket() < 0) {
+		qWarning("QSocketNotifier: Internal error: sockfd < 0");
+		return;
+	}
+
+	if (notifier->thread() != thread() || thread() != QThread::currentThread()) {
+		qWarning("QSocketNotifier: socket notifiers cannot be disabled from another thread");
+		return;
+	}
+#endif
+
+	Q_D(EventDispatcherIOUring);
+	d->unregisterSocketNotifier(notifier);
+}
+
+void EventDispatcherIOUring::registerTimer(
+	int timerId,
+	int interval,
+#if QT_VERSION >= 0x050000
+	Qt::TimerType timerType,
+#endif
+	QObject* object
+)
+{
+#ifndef QT_NO_DEBUG
+	if (timerId < 1 || interval < 0 || !object) {
+		qWarning("%s: invalid arguments", Q_FUNC_INFO);
+		return;
+	}
+
+	if (object->thread() != this->thread() && this->thread() != QThread::currentThread()) {
+		qWarning("%s: timers cannot be started from another thread", Q_FUNC_INFO);
+		return;
+	}
+#endif
+
+	Qt::TimerType type;
+#if QT_VERSION >= 0x050000
+	type = timerType;
+#else
+	type = Qt::CoarseTimer;
+#endif
+
+	Q_D(EventDispatcherIOUring);
+	if (interval) {
+		d->registerTimer(timerId, qint64(interval) * 1000000, type, object);
+	}
+	else {
+		d->registerZeroTimer(timerId, object);
+	}
+}
+
+bool EventDispatcherIOUring::unregisterTimer(int timerId)
+{
+#ifndef QT_NO_DEBUG
+	if (timerId < 1) {
+		qWarning("%s: invalid arguments", Q_FUNC_INFO);
+		return false;
+	}
+
+	if (this->thread() != QThread::currentThread()) {
+		qWarning("%s: timers cannot be stopped from another thread", Q_FUNC_INFO);
+		return false;
+	}
+#endif
+
+	Q_D(EventDispatcherIOUring);
+	return d->unregisterTimer(timerId);
+}
+
+bool EventDispatcherIOUring::unregisterTimers(QObject* object)
+{
+#ifndef QT_NO_DEBUG
+	if (!object) {
+		qWarning("%s: invalid arguments", Q_FUNC_INFO);
+		return false;
+	}
+
+	if (object->thread() != this->thread() && this->thread() != QThread::currentThread()) {
+		qWarning("%s: timers cannot be stopped from another thread", Q_FUNC_INFO);
+		return false;
+	}
+#endif
+
+	Q_D(EventDispatcherIOUring);
+	return d->unregisterTimers(object);
+}
+
+QList<QAbstractEventDispatcher::TimerInfo> EventDispatcherIOUring::registeredTimers(QObject* object) const
+{
+	if (!object) {
+		qWarning("%s: invalid argument", Q_FUNC_INFO);
+		return QList<QAbstractEventDispatcher::TimerInfo>();
+	}
+
+	Q_D(const EventDispatcherIOUring);
+	return d->registeredTimers(object);
+}
+
+#if QT_VERSION >= 0x050000
+int EventDispatcherIOUring::remainingTime(int timerId)
+{
+	Q_D(const EventDispatcherIOUring);
+	return d->remainingTime(timerId);
+}
+#endif
+
+void EventDispatcherIOUring::wakeUp(void)
+{
+	Q_D(EventDispatcherIOUring);
+	d->wakeup();
+}
+
+void EventDispatcherIOUring::interrupt(void)
+{
+	Q_D(EventDispatcherIOUring);
+	d->m_interrupt = true;
+	this->wakeUp();
+}
+
+void EventDispatcherIOUring::flush(void)
+{
+}
+
+bool EventDispatcherIOUring::isSupported(void)
+{
+	return IOURing::isSupported();
+}
@@ -0,0 +1,54 @@
+#ifndef EVENTDISPATCHER_IOURING_H
+#define EVENTDISPATCHER_IOURING_H
+
+#include <QtCore/QAbstractEventDispatcher>
+
+class EventDispatcherIOUringPrivate;
+
+class EventDispatcherIOUring : public QAbstractEventDispatcher {
+	Q_OBJECT
+public:
+	explicit EventDispatcherIOUring(QObject* parent = 0);
+	virtual ~EventDispatcherIOUring(void);
+
+	virtual bool processEvents(QEventLoop::ProcessEventsFlags flags);
+	virtual bool hasPendingEvents(void);
+
+	virtual void registerSocketNotifier(QSocketNotifier* notifier);
+	virtual void unregisterSocketNotifier(QSocketNotifier* notifier);
+
+	virtual void registerTimer(
+		int timerId,
+		int interval,
+#if QT_VERSION >= 0x050000
+		Qt::TimerType timerType,
+#endif
+		QObject* object
+	);
+
+	virtual bool unregisterTimer(int timerId);
+	virtual bool unregisterTimers(QObject* object);
+	virtual QList<QAbstractEventDispatcher::TimerInfo> registeredTimers(QObject* object) const;
+#if QT_VERSION >= 0x050000
+	virtual int remainingTime(int timerId);
+#endif
+
+	virtual void wakeUp(void);
+	virtual void interrupt(void);
+	virtual void flush(void);
+
+	// Whether the running kernel lets this process create io_uring instances;
+	// the constructor aborts if it does not
+	static bool isSupported(void);
+
+private:
+	Q_DISABLE_COPY(EventDispatcherIOUring)
+	Q_DECLARE_PRIVATE(EventDispatcherIOUring)
+#if QT_VERSION >= 0x040600
+	QScopedPointer<EventDispatcherIOUringPrivate> d_ptr;
+#else
+	EventDispatcherIOUringPrivate* d_ptr;
+#endif
+};
+
+#endif // EVENTDISPATCHER_IOURING_H
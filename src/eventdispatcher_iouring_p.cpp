@@ -0,0 +1,429 @@
+#include <QtCore/QCoreApplication>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "eventdispatcher_iouring.h"
+#include "eventdispatcher_iouring_p.h"
+#include "qt4compat.h"
+
+#ifndef __NR_io_uring_setup
+#	define __NR_io_uring_setup 425
+#endif
+
+#ifndef __NR_io_uring_enter
+#	define __NR_io_uring_enter 426
+#endif
+
+namespace {
+	inline int io_uring_setup(unsigned int entries, struct io_uring_params* p)
+	{
+		return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+	}
+
+	inline int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+	{
+		return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, 0, 0));
+	}
+
+	// The kernel updates the heads and tails concurrently with us
+	inline unsigned int loadAcquire(const unsigned int* p)
+	{
+		return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+	}
+
+	inline void storeRelease(unsigned int* p, unsigned int v)
+	{
+		__atomic_store_n(p, v, __ATOMIC_RELEASE);
+	}
+
+	inline void* offset(void* base, unsigned int off)
+	{
+		return static_cast<char*>(base) + off;
+	}
+}
+
+IOURing::IOURing(void)
+	: m_fd(-1), m_sq_ring(MAP_FAILED), m_cq_ring(MAP_FAILED), m_sqes(0),
+	  m_sq_ring_size(0), m_cq_ring_size(0), m_sqes_size(0),
+	  m_sq_khead(0), m_sq_ktail(0), m_sq_kflags(0), m_sq_mask(0), m_sq_entries(0), m_sq_tail(0),
+	  m_cq_khead(0), m_cq_ktail(0), m_cq_mask(0), m_cqes(0)
+{
+}
+
+IOURing::~IOURing(void)
+{
+	if (this->m_sqes) {
+		munmap(this->m_sqes, this->m_sqes_size);
+	}
+
+	if (this->m_cq_ring != MAP_FAILED && this->m_cq_ring != this->m_sq_ring) {
+		munmap(this->m_cq_ring, this->m_cq_ring_size);
+	}
+
+	if (this->m_sq_ring != MAP_FAILED) {
+		munmap(this->m_sq_ring, this->m_sq_ring_size);
+	}
+
+	if (this->m_fd != -1) {
+		close(this->m_fd);
+	}
+}
+
+bool IOURing::setup(unsigned int entries)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+
+	this->m_fd = io_uring_setup(entries, &p);
+	if (-1 == this->m_fd) {
+		return false;
+	}
+
+	this->m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	this->m_cq_ring_size = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		this->m_sq_ring_size = qMax(this->m_sq_ring_size, this->m_cq_ring_size);
+		this->m_cq_ring_size = this->m_sq_ring_size;
+	}
+
+	this->m_sq_ring = mmap(0, this->m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->m_fd, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == this->m_sq_ring) {
+		return false;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		this->m_cq_ring = this->m_sq_ring;
+	}
+	else {
+		this->m_cq_ring = mmap(0, this->m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->m_fd, IORING_OFF_CQ_RING);
+		if (MAP_FAILED == this->m_cq_ring) {
+			return false;
+		}
+	}
+
+	this->m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	void* sqes        = mmap(0, this->m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->m_fd, IORING_OFF_SQES);
+	if (MAP_FAILED == sqes) {
+		return false;
+	}
+
+	this->m_sqes       = static_cast<struct io_uring_sqe*>(sqes);
+	this->m_sq_khead   = static_cast<unsigned int*>(offset(this->m_sq_ring, p.sq_off.head));
+	this->m_sq_ktail   = static_cast<unsigned int*>(offset(this->m_sq_ring, p.sq_off.tail));
+	this->m_sq_kflags  = static_cast<unsigned int*>(offset(this->m_sq_ring, p.sq_off.flags));
+	this->m_sq_mask    = *static_cast<unsigned int*>(offset(this->m_sq_ring, p.sq_off.ring_mask));
+	this->m_sq_entries = p.sq_entries;
+	this->m_sq_tail    = *this->m_sq_ktail;
+	this->m_cq_khead   = static_cast<unsigned int*>(offset(this->m_cq_ring, p.cq_off.head));
+	this->m_cq_ktail   = static_cast<unsigned int*>(offset(this->m_cq_ring, p.cq_off.tail));
+	this->m_cq_mask    = *static_cast<unsigned int*>(offset(this->m_cq_ring, p.cq_off.ring_mask));
+	this->m_cqes       = static_cast<struct io_uring_cqe*>(offset(this->m_cq_ring, p.cq_off.cqes));
+
+	// Entries are always submitted in order, so the indirection array never changes
+	unsigned int* array = static_cast<unsigned int*>(offset(this->m_sq_ring, p.sq_off.array));
+	for (unsigned int i=0; i<p.sq_entries; ++i) {
+		array[i] = i;
+	}
+
+	return true;
+}
+
+struct io_uring_sqe* IOURing::sqe(void)
+{
+	if (Q_UNLIKELY(this->m_sq_tail - loadAcquire(this->m_sq_khead) >= this->m_sq_entries)) {
+		this->enter(false);
+	}
+
+	struct io_uring_sqe* res = &this->m_sqes[this->m_sq_tail & this->m_sq_mask];
+	++this->m_sq_tail;
+
+	memset(res, 0, sizeof(struct io_uring_sqe));
+	return res;
+}
+
+int IOURing::enter(bool wait)
+{
+	storeRelease(this->m_sq_ktail, this->m_sq_tail);
+
+	unsigned int to_submit = this->m_sq_tail - loadAcquire(this->m_sq_khead);
+	unsigned int flags     = wait ? IORING_ENTER_GETEVENTS : 0;
+
+	if (Q_UNLIKELY(loadAcquire(this->m_sq_kflags) & IORING_SQ_CQ_OVERFLOW)) {
+		// Completions that did not fit into the queue are kept by the kernel until we ask for them
+		flags |= IORING_ENTER_GETEVENTS;
+	}
+
+	if (!to_submit && !flags) {
+		return 0;
+	}
+
+	int res;
+	do {
+		res = io_uring_enter(this->m_fd, to_submit, wait ? 1 : 0, flags);
+	} while (Q_UNLIKELY(-1 == res && EINTR == errno));
+
+	if (Q_UNLIKELY(-1 == res)) {
+		qErrnoWarning("%s: io_uring_enter() failed", Q_FUNC_INFO);
+	}
+
+	return res;
+}
+
+const struct io_uring_cqe* IOURing::cqe(void) const
+{
+	unsigned int head = *this->m_cq_khead;
+	if (head == loadAcquire(this->m_cq_ktail)) {
+		return 0;
+	}
+
+	return &this->m_cqes[head & this->m_cq_mask];
+}
+
+void IOURing::consume(void)
+{
+	storeRelease(this->m_cq_khead, *this->m_cq_khead + 1);
+}
+
+bool IOURing::isSupported(void)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+
+	int fd = io_uring_setup(1, &p);
+	if (-1 == fd) {
+		return false;
+	}
+
+	close(fd);
+	return true;
+}
+
+EventDispatcherIOUringPrivate::EventDispatcherIOUringPrivate(EventDispatcherIOUring* const q)
+	: q_ptr(q), m_ring(), m_event_fd(-1), m_wakeup_value(0), m_interrupt(false),
+#if QT_VERSION >= 0x040400
+	  m_wakeups(),
+#endif
+	  m_handle_pool(), m_timer_pool(), m_zero_timer_pool(),
+	  m_handles(), m_pending_handles(), m_dead_handles(), m_dispatch_depth(0),
+	  m_timers(), m_expired(), m_zero_timers(), m_zero_first(0), m_zero_last(0),
+	  m_zero_generation(0), m_zero_dispatch_depth(0), m_zero_dead(0)
+{
+	if (Q_UNLIKELY(!this->m_ring.setup(256))) {
+		qErrnoWarning("io_uring_setup() failed");
+		abort();
+	}
+
+	// Blocking on purpose: the read request completes when somebody writes to the eventfd
+	this->m_event_fd = eventfd(0, EFD_CLOEXEC);
+	if (Q_UNLIKELY(-1 == this->m_event_fd)) {
+		qErrnoWarning("eventfd() failed");
+		abort();
+	}
+
+	this->armWakeUp();
+}
+
+EventDispatcherIOUringPrivate::~EventDispatcherIOUringPrivate(void)
+{
+	close(this->m_event_fd);
+
+	// m_ring is destroyed after the pools: closing the ring cancels the outstanding requests.
+	// All handles and timers live in the pools and are freed with them
+}
+
+bool EventDispatcherIOUringPrivate::processEvents(QEventLoop::ProcessEventsFlags flags)
+{
+	Q_Q(EventDispatcherIOUring);
+
+	const bool exclude_notifiers = (flags & QEventLoop::ExcludeSocketNotifiers);
+	const bool exclude_timers    = (flags & QEventLoop::X11ExcludeTimers);
+
+	this->m_interrupt = false;
+	Q_EMIT q->awake();
+
+	bool result = q->hasPendingEvents();
+
+#if QT_VERSION < 0x040500
+	QCoreApplication::sendPostedEvents(0, (flags & QEventLoop::DeferredDeletion) ? -1 : 0);
+#else
+	QCoreApplication::sendPostedEvents();
+#endif
+
+	bool can_wait =
+			!this->m_interrupt
+		 && (flags & QEventLoop::WaitForMoreEvents)
+		 && !result
+	;
+
+	int n_events = 0;
+
+	if (!this->m_interrupt) {
+		if (!exclude_timers && !this->m_expired.isEmpty()) {
+			// Some timers expired while timers were excluded
+			this->activateTimers();
+			result = true;
+		}
+
+		if (!exclude_timers && this->m_zero_first && this->activateZeroTimers()) {
+			result = true;
+		}
+
+		if (!exclude_notifiers && !this->m_pending_handles.isEmpty()) {
+			// Descriptors that became ready while socket notifiers were excluded; they are dispatched below,
+			// after the completions, so that their re-armed requests are not submitted until the next iteration
+			result = true;
+		}
+
+		bool wait = can_wait && !result;
+		if (wait) {
+			Q_EMIT q->aboutToBlock();
+		}
+
+		// Everything queued since the previous iteration is submitted by the same call that waits for completions
+		for (;;) {
+			if (Q_UNLIKELY(-1 == this->m_ring.enter(wait))) {
+				break;
+			}
+
+			n_events += this->processCompletions(exclude_notifiers);
+			if (n_events > 0 || !wait || this->m_interrupt) {
+				break;
+			}
+		}
+
+		if (!exclude_notifiers && !this->m_pending_handles.isEmpty()) {
+			this->dispatchPendingHandles();
+		}
+
+		if (!exclude_timers && !this->m_expired.isEmpty()) {
+			this->activateTimers();
+		}
+	}
+
+	return result || n_events > 0;
+}
+
+int EventDispatcherIOUringPrivate::processCompletions(bool exclude_notifiers)
+{
+	int n = 0;
+
+	const struct io_uring_cqe* cqe;
+	while ((cqe = this->m_ring.cqe()) != 0) {
+		// Copy and release the completion first: the handlers can run nested event loops
+		const quint64 user_data = cqe->user_data;
+		const int res           = cqe->res;
+		this->m_ring.consume();
+
+		void* ptr = reinterpret_cast<void*>(static_cast<quintptr>(user_data & ~quint64(utMask)));
+		switch (user_data & utMask) {
+			case utTimer: {
+				URingTimer* t = static_cast<URingTimer*>(ptr);
+				t->in_flight  = false;
+
+				if (t->dead) {
+					this->m_timer_pool.release(t);
+				}
+				else if (-ETIME == res) {
+					// Dispatched by activateTimers(), possibly on a later iteration if timers are excluded
+					this->m_expired.append(t->info.timerId);
+					++n;
+				}
+				else if (-ECANCELED != res) {
+					errno = -res;
+					qErrnoWarning("%s: timeout request failed", Q_FUNC_INFO);
+				}
+
+				break;
+			}
+
+			case utPoll: {
+				URingHandle* h = static_cast<URingHandle*>(ptr);
+				h->armed       = 0;
+
+				if (h->dead) {
+					this->releaseHandle(h);
+				}
+				else if (res > 0) {
+					++n;
+					if (exclude_notifiers) {
+						// The request is not re-armed until the readiness has been dispatched
+						h->revents = static_cast<uint>(res);
+						h->pending = true;
+						this->m_pending_handles.append(h);
+					}
+					else {
+						this->dispatchHandle(h, static_cast<uint>(res));
+					}
+				}
+				else {
+					errno = -res;
+					qErrnoWarning("%s: poll request failed", Q_FUNC_INFO);
+				}
+
+				break;
+			}
+
+			case utWakeUp:
+				this->wake_up_handler(res);
+				++n;
+				break;
+
+			case utIgnore:
+				break;
+
+			default:
+				Q_UNREACHABLE();
+		}
+	}
+
+	return n;
+}
+
+void EventDispatcherIOUringPrivate::wake_up_handler(int res)
+{
+	if (Q_UNLIKELY(res < 0)) {
+		errno = -res;
+		qErrnoWarning("%s: eventfd read request failed", Q_FUNC_INFO);
+	}
+
+#if QT_VERSION >= 0x040400
+	if (Q_UNLIKELY(!this->m_wakeups.testAndSetRelease(1, 0))) {
+		qCritical("%s: internal error, testAndSetRelease(1, 0) failed!", Q_FUNC_INFO);
+	}
+#endif
+
+	this->armWakeUp();
+}
+
+void EventDispatcherIOUringPrivate::wakeup(void)
+{
+#if QT_VERSION >= 0x040400
+	if (this->m_wakeups.testAndSetAcquire(0, 1))
+#endif
+	{
+		const eventfd_t value = 1;
+		int res;
+
+		do {
+			res = eventfd_write(this->m_event_fd, value);
+		} while (Q_UNLIKELY(-1 == res && EINTR == errno));
+
+		if (Q_UNLIKELY(-1 == res)) {
+			qErrnoWarning("%s: eventfd_write() failed", Q_FUNC_INFO);
+		}
+	}
+}
+
+void EventDispatcherIOUringPrivate::armWakeUp(void)
+{
+	struct io_uring_sqe* sqe = this->m_ring.sqe();
+	sqe->opcode    = IORING_OP_READ;
+	sqe->fd        = this->m_event_fd;
+	sqe->addr      = reinterpret_cast<quintptr>(&this->m_wakeup_value);
+	sqe->len       = sizeof(this->m_wakeup_value);
+	sqe->user_data = utWakeUp;
+}
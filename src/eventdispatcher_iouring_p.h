@@ -0,0 +1,163 @@
+#ifndef EVENTDISPATCHER_IOURING_P_H
+#define EVENTDISPATCHER_IOURING_P_H
+
+#include <qplatformdefs.h>
+#include <QtCore/QAbstractEventDispatcher>
+#include <QtCore/QVector>
+
+#if QT_VERSION >= 0x040400
+#	include <QtCore/QAtomicInt>
+#endif
+
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+#include "eventdispatcher_iouring.h"
+#include "eventdispatcher_epoll_p.h"
+#include "objectpool_p.h"
+#include "qt4compat.h"
+
+// Submission and completion queues of an io_uring instance, driven through the raw system calls
+class Q_DECL_HIDDEN IOURing {
+public:
+	IOURing(void);
+	~IOURing(void);
+
+	bool setup(unsigned int entries);
+
+	// Returns a cleared submission queue entry; if the queue is full, the queued entries are submitted first
+	struct io_uring_sqe* sqe(void);
+
+	// Submits everything queued so far and, if wait is true, blocks until at least one completion is available.
+	// Does not enter the kernel at all if there is nothing to submit and nothing to wait for
+	int enter(bool wait);
+
+	// Returns the oldest completion or 0 if there is none; consume() releases it back to the kernel
+	const struct io_uring_cqe* cqe(void) const;
+	void consume(void);
+
+	static bool isSupported(void);
+
+private:
+	Q_DISABLE_COPY(IOURing)
+
+	int m_fd;
+	void* m_sq_ring;
+	void* m_cq_ring;
+	struct io_uring_sqe* m_sqes;
+	size_t m_sq_ring_size;
+	size_t m_cq_ring_size;
+	size_t m_sqes_size;
+
+	unsigned int* m_sq_khead;
+	unsigned int* m_sq_ktail;
+	unsigned int* m_sq_kflags;
+	unsigned int m_sq_mask;
+	unsigned int m_sq_entries;
+	unsigned int m_sq_tail;
+
+	unsigned int* m_cq_khead;
+	unsigned int* m_cq_ktail;
+	unsigned int m_cq_mask;
+	struct io_uring_cqe* m_cqes;
+};
+
+// What a completion refers to; stored in the low bits of user_data, the rest is a pointer to the record
+enum URingTag {
+	utTimer  = 0,
+	utPoll   = 1,
+	utWakeUp = 2,
+	utIgnore = 3,
+	utMask   = 3
+};
+
+struct URingHandle {
+	SocketNotifierInfo sni;  // events are poll(2) flags
+	int fd;
+	uint armed;              // events of the poll request owned by the kernel, 0 if there is none
+	uint revents;            // readiness to dispatch once socket notifiers are no longer excluded
+	bool pending;            // queued in m_pending_handles
+	bool dead;               // all notifiers are gone; freed once neither the kernel nor we reference it
+};
+
+struct URingTimer {
+	TimerInfo info;          // only when, deadline, and the fields describing the timer are used
+	struct __kernel_timespec expires; // absolute CLOCK_MONOTONIC expiration; read by the kernel on submission
+	bool in_flight;          // a timeout request for the timer is owned by the kernel
+	bool dead;               // unregistered; freed when its request completes
+};
+
+class Q_DECL_HIDDEN EventDispatcherIOUringPrivate {
+public:
+	EventDispatcherIOUringPrivate(EventDispatcherIOUring* const q);
+	~EventDispatcherIOUringPrivate(void);
+	bool processEvents(QEventLoop::ProcessEventsFlags flags);
+	void registerSocketNotifier(QSocketNotifier* notifier);
+	void unregisterSocketNotifier(QSocketNotifier* notifier);
+	void registerTimer(int timerId, qint64 interval, Qt::TimerType type, QObject* object);
+	void registerZeroTimer(int timerId, QObject* object);
+	bool unregisterTimer(int timerId);
+	bool unregisterTimers(QObject* object);
+	QList<QAbstractEventDispatcher::TimerInfo> registeredTimers(QObject* object) const;
+	int remainingTime(int timerId) const;
+	void wakeup(void);
+
+	typedef QVector<URingHandle*> HandleTable;
+	typedef QVector<URingTimer*> TimerTable;
+	typedef QVector<ZeroTimer*> ZeroTimerTable;
+
+private:
+	Q_DISABLE_COPY(EventDispatcherIOUringPrivate)
+	Q_DECLARE_PUBLIC(EventDispatcherIOUring)
+	EventDispatcherIOUring* const q_ptr;
+
+	IOURing m_ring;
+	int m_event_fd;
+	eventfd_t m_wakeup_value;
+	bool m_interrupt;
+#if QT_VERSION >= 0x040400
+	QAtomicInt m_wakeups;
+#endif
+	ObjectPool<URingHandle> m_handle_pool;
+	ObjectPool<URingTimer> m_timer_pool;
+	ObjectPool<ZeroTimer> m_zero_timer_pool;
+	HandleTable m_handles; // indexed by file descriptor
+	QVector<URingHandle*> m_pending_handles;
+	QVector<URingHandle*> m_dead_handles;
+	int m_dispatch_depth;
+	TimerTable m_timers;   // indexed by timer ID
+	QVector<int> m_expired;
+	ZeroTimerTable m_zero_timers; // indexed by timer ID
+	ZeroTimer* m_zero_first;
+	ZeroTimer* m_zero_last;
+	quint64 m_zero_generation;
+	int m_zero_dispatch_depth;
+	int m_zero_dead;              // dead zero timers waiting to be unlinked
+
+	int processCompletions(bool exclude_notifiers);
+	void dispatchHandle(URingHandle* h, uint revents);
+	void dispatchPendingHandles(void);
+	void activateTimers(void);
+	void wake_up_handler(int res);
+	static void socket_notifier_callback(const SocketNotifierInfo& n, uint revents);
+
+	void armWakeUp(void);
+	void armPoll(URingHandle* h);
+	void cancelPoll(URingHandle* h);
+	void updatePoll(URingHandle* h);
+	void armTimer(URingTimer* t);
+	void cancelTimer(URingTimer* t);
+
+	URingHandle* handle(int fd) const;
+	void releaseHandle(URingHandle* h);
+	void freeDeadHandles(void);
+
+	URingTimer* timer(int timerId) const;
+	ZeroTimer* zeroTimer(int timerId) const;
+	void releaseTimer(URingTimer* t);
+	void unregisterZeroTimer(ZeroTimer* data);
+	void unlinkZeroTimer(ZeroTimer* data);
+	bool activateZeroTimers(void);
+	void sweepZeroTimers(void);
+};
+
+#endif // EVENTDISPATCHER_IOURING_P_H
@@ -0,0 +1,111 @@
+#ifndef OBJECTPOOL_P_H
+#define OBJECTPOOL_P_H
+
+#include <QtCore/QVector>
+#include <new>
+#include <stdlib.h>
+#include "qt4compat.h"
+
+// Objects never straddle more cache lines than they have to:
+// small objects get a power-of-two slot, larger ones are padded to a multiple of the cache line
+template<size_t N>
+struct PoolStride {
+	enum {
+		CacheLine = 64,
+		value     =
+			  N <= 8  ? 8
+			: N <= 16 ? 16
+			: N <= 32 ? 32
+			: N <= 64 ? 64
+			: ((N + CacheLine - 1) / CacheLine) * CacheLine
+	};
+};
+
+// Free list allocator for the fixed size records the dispatcher creates and destroys all the time.
+// Memory is taken from the heap in cache line aligned chunks and is returned only when the pool is destroyed;
+// the pool is not thread safe
+template<typename T>
+class ObjectPool {
+public:
+	ObjectPool(void) : m_free(0), m_chunks(), m_in_use(0), m_high_water(0), m_capacity(0) {}
+
+	~ObjectPool(void)
+	{
+		for (int i=0; i<this->m_chunks.size(); ++i) {
+			free(this->m_chunks.at(i));
+		}
+	}
+
+	T* allocate(void)
+	{
+		if (Q_UNLIKELY(!this->m_free)) {
+			this->grow();
+		}
+
+		Node* node   = this->m_free;
+		this->m_free = node->next;
+
+		++this->m_in_use;
+		if (this->m_in_use > this->m_high_water) {
+			this->m_high_water = this->m_in_use;
+		}
+
+		return new(node) T();
+	}
+
+	void release(T* p)
+	{
+		Q_ASSERT(p != 0);
+
+		p->~T();
+		Node* node   = reinterpret_cast<Node*>(p);
+		node->next   = this->m_free;
+		this->m_free = node;
+		--this->m_in_use;
+	}
+
+	int inUse(void) const     { return this->m_in_use; }
+	int highWater(void) const { return this->m_high_water; }
+	int capacity(void) const  { return this->m_capacity; }
+
+private:
+	Q_DISABLE_COPY(ObjectPool)
+
+	enum {
+		Stride    = PoolStride<sizeof(T) < sizeof(void*) ? sizeof(void*) : sizeof(T)>::value,
+		CacheLine = PoolStride<sizeof(T)>::CacheLine,
+		ChunkSize = 4096,
+		PerChunk  = ChunkSize / Stride > 0 ? ChunkSize / Stride : 1
+	};
+
+	union Node {
+		Node* next;
+		char storage[Stride];
+	};
+
+	Node* m_free;
+	QVector<void*> m_chunks;
+	int m_in_use;
+	int m_high_water;
+	int m_capacity;
+
+	void grow(void)
+	{
+		void* mem;
+		if (Q_UNLIKELY(0 != posix_memalign(&mem, CacheLine, PerChunk * sizeof(Node)))) {
+			qFatal("%s: out of memory", Q_FUNC_INFO);
+		}
+
+		this->m_chunks.append(mem);
+
+		Node* nodes = static_cast<Node*>(mem);
+		for (int i=0; i<PerChunk; ++i) {
+			nodes[i].next = (i + 1 < PerChunk) ? &nodes[i + 1] : this->m_free;
+		}
+
+		this->m_free      = nodes;
+		this->m_capacity += PerChunk;
+	}
+};
+
+#endif // OBJECTPOOL_P_H
@@ -0,0 +1,165 @@
+#include <QtCore/QtGlobal>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include "eventdispatcher_epoll_p.h"
+#include "qt4compat.h"
+
+bool EventDispatcherEPollPrivate::watchSignal(int signo, EventDispatcherEPoll::SignalCallback callback, void (*drop)(void*), void* context)
+{
+	SignalWatch watch;
+	watch.callback = callback;
+	watch.drop     = drop;
+	watch.context  = context;
+
+	if (Q_UNLIKELY(signo <= 0 || signo >= _NSIG || SIGKILL == signo || SIGSTOP == signo)) {
+		qWarning("%s: signal %d cannot be watched", Q_FUNC_INFO, signo);
+		this->releaseContext(watch.drop, watch.context);
+		return false;
+	}
+
+	// The table grows before the signal gets blocked; later failures restore the signal mask
+	if (signo >= this->m_signal_watches.size()) {
+		int size = this->m_signal_watches.size();
+		this->m_signal_watches.resize(signo + 1);
+		for (int i=size; i<=signo; ++i) {
+			this->m_signal_watches[i].callback = 0;
+			this->m_signal_watches[i].drop     = 0;
+			this->m_signal_watches[i].context  = 0;
+		}
+	}
+
+	sigset_t set;
+	sigset_t old_set;
+	sigemptyset(&set);
+	sigaddset(&set, signo);
+
+	// The signal must not be delivered the usual way, or the signalfd will never see it
+	int res = pthread_sigmask(SIG_BLOCK, &set, &old_set);
+	if (Q_UNLIKELY(0 != res)) {
+		errno = res;
+		qErrnoWarning("%s: pthread_sigmask() failed", Q_FUNC_INFO);
+		this->releaseContext(watch.drop, watch.context);
+		return false;
+	}
+
+	sigset_t mask = this->m_signal_mask;
+	sigaddset(&mask, signo);
+
+	bool ok = true;
+	if (-1 == this->m_signal_fd) {
+		int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+		if (Q_UNLIKELY(-1 == fd)) {
+			qErrnoWarning("%s: signalfd() failed", Q_FUNC_INFO);
+			ok = false;
+		}
+		else {
+			// Signals are registered like socket notifiers, so ExcludeSocketNotifiers leaves them pending
+			struct epoll_event e;
+			e.events   = EPOLLIN;
+			e.data.u64 = htSignalFd;
+			if (Q_UNLIKELY(-1 == epoll_ctl(this->m_epoll_fd, EPOLL_CTL_ADD, fd, &e))) {
+				qErrnoWarning("%s: epoll_ctl() failed", Q_FUNC_INFO);
+				close(fd);
+				ok = false;
+			}
+			else {
+				this->m_signal_fd = fd;
+			}
+		}
+	}
+	else if (Q_UNLIKELY(-1 == signalfd(this->m_signal_fd, &mask, 0))) {
+		qErrnoWarning("%s: signalfd() failed", Q_FUNC_INFO);
+		ok = false;
+	}
+
+	if (Q_UNLIKELY(!ok)) {
+		// Nothing would read the signal: it is unblocked again unless it was blocked before
+		pthread_sigmask(SIG_SETMASK, &old_set, 0);
+		this->releaseContext(watch.drop, watch.context);
+		return false;
+	}
+
+	this->m_signal_mask = mask;
+
+	SignalWatch old = this->m_signal_watches.at(signo);
+	this->m_signal_watches[signo] = watch;
+	if (old.callback) {
+		this->releaseContext(old.drop, old.context);
+	}
+
+	return true;
+}
+
+void EventDispatcherEPollPrivate::unwatchSignal(int signo)
+{
+	if (signo <= 0 || signo >= this->m_signal_watches.size() || !this->m_signal_watches.at(signo).callback) {
+		return;
+	}
+
+	SignalWatch old = this->m_signal_watches.at(signo);
+	this->m_signal_watches[signo].callback = 0;
+	this->m_signal_watches[signo].drop     = 0;
+	this->m_signal_watches[signo].context  = 0;
+
+	sigdelset(&this->m_signal_mask, signo);
+
+	if (sigisemptyset(&this->m_signal_mask)) {
+		// Closing the signalfd does not remove it from the epoll set if a duplicate exists (e.g. in a forked child)
+		if (Q_UNLIKELY(-1 == epoll_ctl(this->m_epoll_fd, EPOLL_CTL_DEL, this->m_signal_fd, 0))) {
+			qErrnoWarning("%s: epoll_ctl() failed", Q_FUNC_INFO);
+		}
+
+		close(this->m_signal_fd);
+		this->m_signal_fd = -1;
+	}
+	else if (Q_UNLIKELY(-1 == signalfd(this->m_signal_fd, &this->m_signal_mask, 0))) {
+		qErrnoWarning("%s: signalfd() failed", Q_FUNC_INFO);
+	}
+
+	this->releaseContext(old.drop, old.context);
+}
+
+void EventDispatcherEPollPrivate::signal_handler(void)
+{
+	struct signalfd_siginfo info[32];
+
+	++this->m_callback_depth;
+
+	// A callback can run a nested event loop that reads the signalfd too, or stop watching the last signal
+	while (-1 != this->m_signal_fd) {
+		ssize_t res = read(this->m_signal_fd, info, sizeof(info));
+		if (-1 == res) {
+			if (EINTR == errno) {
+				continue;
+			}
+
+			if (Q_UNLIKELY(EAGAIN != errno)) {
+				qErrnoWarning("%s: read() failed", Q_FUNC_INFO);
+			}
+
+			break;
+		}
+
+		const int n = static_cast<int>(res / static_cast<ssize_t>(sizeof(info[0])));
+		for (int i=0; i<n; ++i) {
+			// The signal could have been unwatched by an earlier callback
+			const int signo = static_cast<int>(info[i].ssi_signo);
+			if (signo < this->m_signal_watches.size()) {
+				const SignalWatch watch = this->m_signal_watches.at(signo);
+				if (watch.callback) {
+					watch.callback(info[i], watch.context);
+				}
+			}
+		}
+
+		if (n < static_cast<int>(sizeof(info) / sizeof(info[0]))) {
+			break;
+		}
+	}
+
+	this->leaveCallbacks();
+}
@@ -0,0 +1,246 @@
+#include <QtCore/QCoreApplication>
+#include <QtCore/QEvent>
+#include <QtCore/QPointer>
+#include <QtCore/QSocketNotifier>
+#include <poll.h>
+#include <errno.h>
+#include "eventdispatcher_iouring_p.h"
+#include "qt4compat.h"
+
+void EventDispatcherIOUringPrivate::registerSocketNotifier(QSocketNotifier* notifier)
+{
+	Q_ASSERT(notifier != 0);
+	Q_ASSUME(notifier != 0);
+
+	uint events = 0;
+	QSocketNotifier** n = 0;
+	int fd = static_cast<int>(notifier->socket());
+
+	URingHandle* h = this->handle(fd);
+	if (!h) {
+		h             = this->m_handle_pool.allocate();
+		h->sni.r      = 0;
+		h->sni.w      = 0;
+		h->sni.x      = 0;
+		h->sni.events = 0;
+		h->fd         = fd;
+		h->armed      = 0;
+		h->revents    = 0;
+		h->pending    = false;
+		h->dead       = false;
+
+		growTable(this->m_handles, fd);
+		this->m_handles[fd] = h;
+	}
+
+	switch (notifier->type()) {
+		case QSocketNotifier::Read:      events = POLLIN;  n = &h->sni.r; break;
+		case QSocketNotifier::Write:     events = POLLOUT; n = &h->sni.w; break;
+		case QSocketNotifier::Exception: events = POLLPRI; n = &h->sni.x; break;
+		default:
+			Q_UNREACHABLE();
+	}
+
+	Q_ASSERT(n != 0);
+	if (Q_UNLIKELY(*n != 0)) {
+		qWarning("%s: cannot add two socket notifiers of the same type for the same descriptor", Q_FUNC_INFO);
+		return;
+	}
+
+	*n             = notifier;
+	h->sni.events |= events;
+	this->updatePoll(h);
+}
+
+void EventDispatcherIOUringPrivate::unregisterSocketNotifier(QSocketNotifier* notifier)
+{
+	Q_ASSERT(notifier != 0);
+	Q_ASSUME(notifier != 0);
+
+	int fd         = static_cast<int>(notifier->socket());
+	URingHandle* h = this->handle(fd);
+	if (Q_LIKELY(h != 0)) {
+		if (h->sni.r == notifier) {
+			h->sni.events &= ~uint(POLLIN);
+			h->sni.r       = 0;
+		}
+		else if (h->sni.w == notifier) {
+			h->sni.events &= ~uint(POLLOUT);
+			h->sni.w       = 0;
+		}
+		else if (h->sni.x == notifier) {
+			h->sni.events &= ~uint(POLLPRI);
+			h->sni.x       = 0;
+		}
+		else {
+			// The notifier is not registered
+			return;
+		}
+
+		if (h->sni.r || h->sni.w || h->sni.x) {
+			this->updatePoll(h);
+		}
+		else {
+			this->m_handles[fd] = 0;
+			h->dead             = true;
+			if (h->armed) {
+				this->cancelPoll(h);
+			}
+
+			this->releaseHandle(h);
+		}
+	}
+}
+
+void EventDispatcherIOUringPrivate::dispatchHandle(URingHandle* h, uint revents)
+{
+	// Errors and hangups are reported regardless of the requested events, let the notifiers find out what happened
+	if (revents & (POLLERR | POLLHUP)) {
+		revents |= h->sni.events & (POLLIN | POLLOUT);
+	}
+
+	++this->m_dispatch_depth;
+	EventDispatcherIOUringPrivate::socket_notifier_callback(h->sni, revents);
+
+	// Poll requests are one shot: this is what makes the notifiers level-triggered
+	if (!h->dead) {
+		this->updatePoll(h);
+	}
+
+	if (0 == --this->m_dispatch_depth) {
+		this->freeDeadHandles();
+	}
+}
+
+void EventDispatcherIOUringPrivate::dispatchPendingHandles(void)
+{
+	QVector<URingHandle*> pending;
+	qSwap(pending, this->m_pending_handles);
+
+	++this->m_dispatch_depth;
+	for (int i=0; i<pending.size(); ++i) {
+		URingHandle* h = pending.at(i);
+		h->pending     = false;
+
+		if (h->dead) {
+			this->releaseHandle(h);
+		}
+		else {
+			this->dispatchHandle(h, h->revents);
+		}
+	}
+
+	if (0 == --this->m_dispatch_depth) {
+		this->freeDeadHandles();
+	}
+}
+
+void EventDispatcherIOUringPrivate::socket_notifier_callback(const SocketNotifierInfo& n, uint revents)
+{
+	QEvent e(QEvent::SockAct);
+
+	QPointer<QSocketNotifier> r(n.r);
+	QPointer<QSocketNotifier> w(n.w);
+	QPointer<QSocketNotifier> x(n.x);
+
+	if (r && (revents & POLLIN)) {
+		QCoreApplication::sendEvent(r, &e);
+	}
+
+	if (w && (revents & POLLOUT)) {
+		QCoreApplication::sendEvent(w, &e);
+	}
+
+	if (x && (revents & POLLPRI)) {
+		QCoreApplication::sendEvent(x, &e);
+	}
+}
+
+void EventDispatcherIOUringPrivate::updatePoll(URingHandle* h)
+{
+	if (h->pending) {
+		// Re-armed after the pending readiness has been dispatched
+		return;
+	}
+
+	if (!h->armed) {
+		if (h->sni.events) {
+			this->armPoll(h);
+		}
+	}
+	else if (h->armed != h->sni.events) {
+		// The armed request is updated in place; should it complete with the old events first,
+		// it is re-armed with the new ones after dispatching
+		struct io_uring_sqe* sqe = this->m_ring.sqe();
+		sqe->opcode        = IORING_OP_POLL_REMOVE;
+		sqe->fd            = -1;
+		sqe->addr          = quint64(reinterpret_cast<quintptr>(h)) | utPoll;
+		sqe->len           = IORING_POLL_UPDATE_EVENTS;
+#if __BYTE_ORDER == __BIG_ENDIAN
+		sqe->poll32_events = (h->sni.events << 16) | (h->sni.events >> 16);
+#else
+		sqe->poll32_events = h->sni.events;
+#endif
+		sqe->user_data     = utIgnore;
+
+		h->armed = h->sni.events;
+	}
+}
+
+void EventDispatcherIOUringPrivate::armPoll(URingHandle* h)
+{
+	struct io_uring_sqe* sqe = this->m_ring.sqe();
+	sqe->opcode        = IORING_OP_POLL_ADD;
+	sqe->fd            = h->fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+	sqe->poll32_events = (h->sni.events << 16) | (h->sni.events >> 16);
+#else
+	sqe->poll32_events = h->sni.events;
+#endif
+	sqe->user_data     = quint64(reinterpret_cast<quintptr>(h)) | utPoll;
+
+	h->armed = h->sni.events;
+}
+
+void EventDispatcherIOUringPrivate::cancelPoll(URingHandle* h)
+{
+	Q_ASSERT(h->armed != 0);
+
+	struct io_uring_sqe* sqe = this->m_ring.sqe();
+	sqe->opcode    = IORING_OP_POLL_REMOVE;
+	sqe->fd        = -1;
+	sqe->addr      = quint64(reinterpret_cast<quintptr>(h)) | utPoll;
+	sqe->user_data = utIgnore;
+}
+
+URingHandle* EventDispatcherIOUringPrivate::handle(int fd) const
+{
+	return (fd >= 0 && fd < this->m_handles.size()) ? this->m_handles.at(fd) : 0;
+}
+
+void EventDispatcherIOUringPrivate::releaseHandle(URingHandle* h)
+{
+	Q_ASSERT(h->dead);
+
+	// The kernel owns the handle until its request completes, m_pending_handles until it is dispatched
+	if (h->armed || h->pending) {
+		return;
+	}
+
+	if (this->m_dispatch_depth > 0) {
+		// The handle being dispatched is still used after its notifiers return
+		this->m_dead_handles.append(h);
+	}
+	else {
+		this->m_handle_pool.release(h);
+	}
+}
+
+void EventDispatcherIOUringPrivate::freeDeadHandles(void)
+{
+	for (int i=0; i<this->m_dead_handles.size(); ++i) {
+		this->m_handle_pool.release(this->m_dead_handles.at(i));
+	}
+
+	this->m_dead_handles.resize(0);
+}
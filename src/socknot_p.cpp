@@ -1,12 +1,21 @@
 #include <QtCore/QCoreApplication>
 #include <QtCore/QEvent>
-#include <QtCore/QPointer>
 #include <QtCore/QSocketNotifier>
 #include <sys/epoll.h>
+#include <algorithm>
 #include <errno.h>
 #include "eventdispatcher_epoll_p.h"
 #include "qt4compat.h"
 
+#ifndef EPOLLEXCLUSIVE
+#	define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
+namespace {
+	// The interest set a descriptor watcher can ask for
+	const uint watcherEvents = EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+}
+
 void EventDispatcherEPollPrivate::registerSocketNotifier(QSocketNotifier* notifier)
 {
 	Q_ASSERT(notifier != 0);
@@ -16,18 +25,10 @@ void EventDispatcherEPollPrivate::registerSocketNotifier(QSocketNotifier* notifi
 	QSocketNotifier** n = 0;
 	int fd = static_cast<int>(notifier->socket());
 
-	epoll_event e;
-	e.data.fd = fd;
-
-	HandleData* data;
-	HandleHash::Iterator it = this->m_handles.find(fd);
+	HandleData* data = this->handle(fd);
 
-	if (it == this->m_handles.end()) {
-		data        = new HandleData;
-		data->type  = htSocketNotifier;
-		data->sni.r = 0;
-		data->sni.w = 0;
-		data->sni.x = 0;
+	if (!data) {
+		data = this->allocateHandle(htSocketNotifier, fd);
 
 		switch (notifier->type()) {
 			case QSocketNotifier::Read:      events = EPOLLIN;  n = &data->sni.r; break;
@@ -37,24 +38,21 @@ void EventDispatcherEPollPrivate::registerSocketNotifier(QSocketNotifier* notifi
 				Q_UNREACHABLE();
 		}
 
-		data->sni.events = events;
-		e.events         = events;
-		*n               = notifier;
-
-		int res = epoll_ctl(this->m_epoll_fd, EPOLL_CTL_ADD, fd, &e);
-		if (Q_UNLIKELY(res != 0)) {
-			qErrnoWarning("%s: epoll_ctl() failed", Q_FUNC_INFO);
-			delete data;
-			return;
+		data->sni.events = events | (this->m_edge_triggered ? uint(EPOLLET) : 0u);
+		this->updateSharedDescriptors();
+		if (events != EPOLLPRI && !this->m_shared.isEmpty() && std::binary_search(this->m_shared.constBegin(), this->m_shared.constEnd(), fd)) {
+			// Only one member of the group is woken up when the descriptor becomes ready
+			data->sni.events |= EPOLLEXCLUSIVE;
 		}
 
-		this->m_handles.insert(fd, data);
+		*n = notifier;
+
+		growTable(this->m_handles, fd);
+		this->m_handles[fd] = data;
+		this->queueChange(data);
 	}
 	else {
-		data = it.value();
-
-		Q_ASSERT(data->type == htSocketNotifier);
-		if (data->type == htSocketNotifier) {
+		if (Q_LIKELY(data->type == htSocketNotifier)) {
 			switch (notifier->type()) {
 				case QSocketNotifier::Read:      events = EPOLLIN;  n = &data->sni.r; break;
 				case QSocketNotifier::Write:     events = EPOLLOUT; n = &data->sni.w; break;
@@ -72,22 +70,24 @@ void EventDispatcherEPollPrivate::registerSocketNotifier(QSocketNotifier* notifi
 			Q_ASSERT((data->sni.events & events) == 0);
 
 			data->sni.events |= events;
-			e.events          = data->sni.events;
 			*n                = notifier;
 
-			int res = epoll_ctl(this->m_epoll_fd, EPOLL_CTL_MOD, fd, &e);
-			if (Q_UNLIKELY(res != 0)) {
-				qErrnoWarning("%s: epoll_ctl() failed", Q_FUNC_INFO);
-				return;
+			if (events == EPOLLPRI) {
+				// EPOLLEXCLUSIVE cannot be combined with EPOLLPRI
+				data->sni.events &= ~uint(EPOLLEXCLUSIVE);
 			}
+
+			if (data->sni.events & EPOLLET) {
+				// Re-enabling an edge-triggered notifier re-arms it even if the interest set ends up the same
+				data->rearm = true;
+			}
+
+			this->queueChange(data);
 		}
 		else {
-			Q_UNREACHABLE();
+			qWarning("%s: descriptor %d is watched with watchDescriptor()", Q_FUNC_INFO, fd);
 		}
 	}
-
-	Q_ASSERT(!this->m_notifiers.contains(notifier));
-	this->m_notifiers.insert(notifier, data);
 }
 
 void EventDispatcherEPollPrivate::unregisterSocketNotifier(QSocketNotifier* notifier)
@@ -95,98 +95,354 @@ void EventDispatcherEPollPrivate::unregisterSocketNotifier(QSocketNotifier* noti
 	Q_ASSERT(notifier != 0);
 	Q_ASSUME(notifier != 0);
 
-	SocketNotifierHash::Iterator it = this->m_notifiers.find(notifier);
-	if (Q_LIKELY(it != this->m_notifiers.end())) {
-		HandleData* info = it.value();
-		int fd           = static_cast<int>(notifier->socket());
-
-		this->m_notifiers.erase(it); // Hash is not rehashed
-
-		HandleHash::Iterator hi = this->m_handles.find(fd);
-		Q_ASSERT(hi != this->m_handles.end());
-
-		struct epoll_event e;
-		e.data.fd = fd;
-
+	int fd           = static_cast<int>(notifier->socket());
+	HandleData* info = this->handle(fd);
+	if (Q_LIKELY(info != 0 && info->type == htSocketNotifier)) {
+		// Events waiting in the ready queue were reported for this notifier, not for the one that may replace it
 		if (info->sni.r == notifier) {
 			info->sni.events &= ~EPOLLIN;
+			info->pending    &= ~EPOLLIN;
 			info->sni.r       = 0;
 		}
 		else if (info->sni.w == notifier) {
 			info->sni.events &= ~EPOLLOUT;
+			info->pending    &= ~EPOLLOUT;
 			info->sni.w       = 0;
 		}
 		else if (info->sni.x == notifier) {
 			info->sni.events &= ~EPOLLPRI;
+			info->pending    &= ~EPOLLPRI;
 			info->sni.x       = 0;
 		}
 		else {
-			qFatal("%s: internal error: cannot find socket notifier", Q_FUNC_INFO);
+			// The notifier is not registered
+			return;
 		}
 
-		e.events = info->sni.events;
-
-		int res;
-
 		if (info->sni.r || info->sni.w || info->sni.x) {
-			res = epoll_ctl(this->m_epoll_fd, EPOLL_CTL_MOD, fd, &e);
+			this->queueChange(info);
+			return;
 		}
-		else {
-			res = epoll_ctl(this->m_epoll_fd, EPOLL_CTL_DEL, fd, &e);
-			if (Q_UNLIKELY(res != 0 && EBADF == errno)) {
-				res = 0;
+
+		// The descriptor is usually closed right after its last notifier is gone. Once it is closed,
+		// EPOLL_CTL_DEL fails, and the registration outlives it if the file is still open elsewhere (e.g. in a forked child),
+		// so the removal cannot wait. A descriptor that has never reached the kernel costs nothing
+		if (info->registered) {
+			int res = this->epollCtl(EPOLL_CTL_DEL, fd, 0);
+			if (Q_UNLIKELY(res != 0 && EBADF != errno && ENOENT != errno)) {
+				qErrnoWarning("%s: epoll_ctl() failed", Q_FUNC_INFO);
 			}
+		}
+
+		this->releaseHandle(fd, info);
+	}
+}
 
-			this->m_handles.erase(hi);
-			delete info;
+bool EventDispatcherEPollPrivate::watchDescriptor(int fd, uint events, EventDispatcherEPoll::DescriptorCallback callback, void (*drop)(void*), void* context)
+{
+	if (Q_UNLIKELY(fd < 0 || (events & ~watcherEvents))) {
+		qWarning("%s: cannot watch descriptor %d for events 0x%x", Q_FUNC_INFO, fd, events);
+		this->releaseContext(drop, context);
+		return false;
+	}
+
+	HandleData* data = this->handle(fd);
+	if (data) {
+		if (Q_UNLIKELY(data->type != htDescriptor)) {
+			qWarning("%s: descriptor %d has socket notifiers", Q_FUNC_INFO, fd);
+			this->releaseContext(drop, context);
+			return false;
 		}
 
-		if (Q_UNLIKELY(res != 0)) {
+		const DescriptorWatch old = data->watch;
+		data->watch.callback = callback;
+		data->watch.drop     = drop;
+		data->watch.context  = context;
+		this->releaseContext(old.drop, old.context);
+		return this->setDescriptorEvents(fd, events);
+	}
+
+	data                 = this->allocateHandle(htDescriptor, fd);
+	data->sni.events     = events;
+	data->watch.callback = callback;
+	data->watch.drop     = drop;
+	data->watch.context  = context;
+
+	// Unlike socket notifiers, a new watcher reaches the kernel at once, so that a descriptor epoll cannot watch is reported
+	if (Q_UNLIKELY(this->updateHandle(data) != 0)) {
+		qErrnoWarning("%s: epoll_ctl() failed", Q_FUNC_INFO);
+		this->m_handle_pool.release(data);
+		this->releaseContext(drop, context);
+		return false;
+	}
+
+	growTable(this->m_handles, fd);
+	this->m_handles[fd] = data;
+	return true;
+}
+
+bool EventDispatcherEPollPrivate::setDescriptorEvents(int fd, uint events)
+{
+	HandleData* data = this->handle(fd);
+	if (Q_UNLIKELY(!data || data->type != htDescriptor || (events & ~watcherEvents))) {
+		return false;
+	}
+
+	data->sni.events = events;
+	if (events & (EPOLLET | EPOLLONESHOT)) {
+		// The kernel has to be told even if the interest set stays the same
+		data->rearm = true;
+	}
+
+	this->queueChange(data);
+	return true;
+}
+
+void EventDispatcherEPollPrivate::unwatchDescriptor(int fd)
+{
+	HandleData* data = this->handle(fd);
+	if (!data || data->type != htDescriptor) {
+		return;
+	}
+
+	// An empty interest set leaves the descriptor in the kernel's set (data->registered is 0 then), so it is always deleted
+	int res = this->epollCtl(EPOLL_CTL_DEL, fd, 0);
+	if (Q_UNLIKELY(res != 0 && EBADF != errno && ENOENT != errno)) {
+		qErrnoWarning("%s: epoll_ctl() failed", Q_FUNC_INFO);
+	}
+
+	const DescriptorWatch old = data->watch;
+	this->releaseHandle(fd, data);
+	this->releaseContext(old.drop, old.context);
+}
+
+void EventDispatcherEPollPrivate::descriptor_callback(HandleData* data, uint events)
+{
+	// The callback can unwatch the descriptor or replace itself, its context is released when it returns
+	const DescriptorWatch watch = data->watch;
+	const int fd                = data->fd;
+
+	if (Q_UNLIKELY(this->m_stats_enabled)) {
+		++this->m_stats.descriptor_events;
+	}
+
+	++this->m_callback_depth;
+
+	if (Q_LIKELY(!this->m_watchdog_budget)) {
+		watch.callback(fd, events, watch.context);
+	}
+	else {
+		const EventDispatcherEPoll::SlowHandlerCallback callback = this->m_watchdog_callback;
+		void* const context = this->m_watchdog_context;
+		const qint64 budget = this->m_watchdog_budget;
+
+		const qint64 start = monotonicClock();
+		watch.callback(fd, events, watch.context);
+		const qint64 duration = (monotonicClock() - start) / 1000;
+
+		if (Q_UNLIKELY(duration > budget)) {
+			EventDispatcherEPoll::SlowHandlerReport report;
+			report.kind      = EventDispatcherEPoll::SlowHandlerReport::Descriptor;
+			report.id        = fd;
+			report.duration  = duration;
+			report.className = "";
+			callback(report, context);
+		}
+	}
+
+	this->leaveCallbacks();
+}
+
+void EventDispatcherEPollPrivate::queueChange(HandleData* data)
+{
+	if (!data->changed) {
+		data->changed = true;
+		this->m_changes.append(data->fd);
+	}
+}
+
+void EventDispatcherEPollPrivate::applyChanges(void)
+{
+	// Handles are looked up again: the one that has queued the change may have been released since then,
+	// and its descriptor may belong to a new handle that has queued a change of its own
+	for (int i=0; i<this->m_changes.size(); ++i) {
+		HandleData* data = this->handle(this->m_changes.at(i));
+		if (!data || !data->changed) {
+			continue;
+		}
+
+		data->changed = false;
+		if (data->sni.events == data->registered && !data->rearm) {
+			// The changes have cancelled each other out
+			continue;
+		}
+
+		data->rearm = false;
+		if (Q_UNLIKELY(this->updateHandle(data) != 0)) {
 			qErrnoWarning("%s: epoll_ctl() failed", Q_FUNC_INFO);
 		}
 	}
+
+	this->m_changes.resize(0);
 }
 
-void EventDispatcherEPollPrivate::socket_notifier_callback(const SocketNotifierInfo& n, int events)
+void EventDispatcherEPollPrivate::socket_notifier_callback(quint64 key, uint events)
 {
 	QEvent e(QEvent::SockAct);
 
-	QPointer<QSocketNotifier> r(n.r);
-	QPointer<QSocketNotifier> w(n.w);
-	QPointer<QSocketNotifier> x(n.x);
+	// A handler can delete the other notifiers, release the handle, or even close the descriptor and open another one
+	// with the same number: the handle is looked up again after every callback, and a stale key finds nothing
+	const int fd     = static_cast<int>(quint32(key));
+	HandleData* data = this->liveHandle(key);
 
-	if (r && (events & EPOLLIN)) {
-		QCoreApplication::sendEvent(r, &e);
+	if (data && data->sni.r && (events & EPOLLIN)) {
+		this->deliverEvent(data->sni.r, &e, EventDispatcherEPoll::SlowHandlerReport::SocketRead, fd);
+		data = this->liveHandle(key);
 	}
 
-	if (w && (events & EPOLLOUT)) {
-		QCoreApplication::sendEvent(w, &e);
+	if (data && data->sni.w && (events & EPOLLOUT)) {
+		this->deliverEvent(data->sni.w, &e, EventDispatcherEPoll::SlowHandlerReport::SocketWrite, fd);
+		data = this->liveHandle(key);
 	}
 
-	if (x && (events & EPOLLPRI)) {
-		QCoreApplication::sendEvent(x, &e);
+	if (data && data->sni.x && (events & EPOLLPRI)) {
+		this->deliverEvent(data->sni.x, &e, EventDispatcherEPoll::SlowHandlerReport::SocketException, fd);
 	}
 }
 
-bool EventDispatcherEPollPrivate::disableSocketNotifiers(bool disable)
+int EventDispatcherEPollPrivate::updateHandle(HandleData* data)
 {
-	epoll_event e;
+	struct epoll_event e;
+	e.events   = data->sni.events;
+	e.data.u64 = handleKey(data);
+
+	const int fd    = data->fd;
+	const uint prev = data->registered;
+	int res;
+
+	if (!prev) {
+		res = this->epollCtl(EPOLL_CTL_ADD, fd, &e);
+		if (Q_UNLIKELY(res != 0 && EEXIST == errno)) {
+			res = this->epollCtl(EPOLL_CTL_MOD, fd, &e);
+		}
+	}
+	else if (!((prev | e.events) & EPOLLEXCLUSIVE)) {
+		res = this->epollCtl(EPOLL_CTL_MOD, fd, &e);
+		if (Q_UNLIKELY(res != 0 && ENOENT == errno)) {
+			// The descriptor has been closed and reopened behind our back
+			res = this->epollCtl(EPOLL_CTL_ADD, fd, &e);
+		}
+	}
+	else {
+		// Exclusive registrations cannot be modified, and EPOLLEXCLUSIVE cannot be added by EPOLL_CTL_MOD:
+		// the descriptor is deleted and added again
+		res = this->epollCtl(EPOLL_CTL_DEL, fd, 0);
+		if (Q_LIKELY(0 == res || ENOENT == errno)) {
+			res = this->epollCtl(EPOLL_CTL_ADD, fd, &e);
+		}
+	}
 
-	SocketNotifierHash::ConstIterator it = this->m_notifiers.constBegin();
-	while (it != this->m_notifiers.constEnd()) {
-		QSocketNotifier* notifier = it.key();
-		HandleData* info          = it.value();
-		int fd                    = static_cast<int>(notifier->socket());
+	if (Q_LIKELY(0 == res)) {
+		data->registered = data->sni.events;
+	}
 
-		e.events  = disable ? 0 : info->sni.events;
-		e.data.fd = fd;
-		int res = epoll_ctl(this->m_epoll_fd, EPOLL_CTL_MOD, fd, &e);
-		if (Q_UNLIKELY(res != 0)) {
-			qErrnoWarning("%s: epoll_ctl() failed", Q_FUNC_INFO);
+	return res;
+}
+
+int EventDispatcherEPollPrivate::epollCtl(int op, int fd, struct epoll_event* e)
+{
+	if (Q_UNLIKELY(this->m_stats_enabled)) {
+		switch (op) {
+			case EPOLL_CTL_ADD: ++this->m_stats.epoll_ctl_add; break;
+			case EPOLL_CTL_MOD: ++this->m_stats.epoll_ctl_mod; break;
+			case EPOLL_CTL_DEL: ++this->m_stats.epoll_ctl_del; break;
+			default:
+				Q_UNREACHABLE();
 		}
+	}
+
+	return epoll_ctl(this->m_epoll_fd, op, fd, e);
+}
 
-		++it;
+void EventDispatcherEPollPrivate::updateSharedDescriptors(void)
+{
+#if QT_VERSION >= 0x040400
+#	if QT_VERSION >= 0x050000
+	if (Q_LIKELY(!this->m_shared_update.load())) {
+#	else
+	if (Q_LIKELY(!static_cast<QVector<int>*>(this->m_shared_update))) {
+#	endif
+		return;
 	}
 
-	return true;
+	QVector<int>* update = this->m_shared_update.fetchAndStoreAcquire(0);
+	if (!update) {
+		return;
+	}
+
+	qSwap(this->m_shared, *update);
+
+	// Descriptors that have joined or left the set switch EPOLLEXCLUSIVE, including the ones that already have notifiers
+	const QVector<int>& old_shared = *update;
+	for (int pass=0; pass<2; ++pass) {
+		const QVector<int>& fds = pass ? old_shared : this->m_shared;
+		for (int i=0; i<fds.size(); ++i) {
+			HandleData* data = this->handle(fds.at(i));
+			if (!data || data->type != htSocketNotifier) {
+				continue;
+			}
+
+			const bool shared    = std::binary_search(this->m_shared.constBegin(), this->m_shared.constEnd(), data->fd);
+			const bool exclusive = shared && !data->sni.x;
+			if (exclusive != bool(data->sni.events & EPOLLEXCLUSIVE)) {
+				data->sni.events ^= EPOLLEXCLUSIVE;
+				this->queueChange(data);
+			}
+		}
+	}
+
+	delete update;
+#endif
+}
+
+HandleData* EventDispatcherEPollPrivate::handle(int fd) const
+{
+	return (fd >= 0 && fd < this->m_handles.size()) ? this->m_handles.at(fd) : 0;
+}
+
+HandleData* EventDispatcherEPollPrivate::liveHandle(quint64 key) const
+{
+	HandleData* data = this->handle(static_cast<int>(quint32(key)));
+	return (data && data->generation == quint32(key >> 32)) ? data : 0;
+}
+
+HandleData* EventDispatcherEPollPrivate::allocateHandle(HandleType type, int fd)
+{
+	// Generation 0 belongs to the dispatcher's own descriptors
+	if (Q_UNLIKELY(0 == ++this->m_generation)) {
+		this->m_generation = 1;
+	}
+
+	HandleData* data = this->m_handle_pool.allocate();
+	data->type       = type;
+	data->fd         = fd;
+	data->generation = this->m_generation;
+	data->pending    = 0;
+	data->registered = 0;
+	data->changed    = false;
+	data->rearm      = false;
+	data->sni.r      = 0;
+	data->sni.w      = 0;
+	data->sni.x      = 0;
+	data->watch.callback = 0;
+	data->watch.drop     = 0;
+	data->watch.context  = 0;
+	return data;
+}
+
+void EventDispatcherEPollPrivate::releaseHandle(int fd, HandleData* data)
+{
+	// Events still referring to the handle carry its generation and will not find it, the memory can be reused right away
+	this->m_handles[fd] = 0;
+	this->m_handle_pool.release(data);
 }
@@ -0,0 +1,319 @@
+#include <QtCore/QCoreApplication>
+#include <QtCore/QEvent>
+#include <QtCore/QVarLengthArray>
+#include <time.h>
+#include <errno.h>
+#include "eventdispatcher_iouring_p.h"
+#include "qt4compat.h"
+
+void EventDispatcherIOUringPrivate::registerTimer(int timerId, qint64 interval, Qt::TimerType type, QObject* object)
+{
+	Q_ASSERT(interval > 0);
+
+	const qint64 now = monotonicClock();
+
+	URingTimer* t   = this->m_timer_pool.allocate();
+	TimerInfo* info = &t->info;
+	info->object    = object;
+	info->when      = now; // calculateNextTimeout() will take care of info->when
+	info->timerId   = timerId;
+	info->overruns  = 0;
+	info->interval  = interval;
+	info->index     = -1;
+	info->type      = type;
+	info->slot      = 0;
+	info->prev      = 0;
+	info->next      = 0;
+	t->in_flight    = false;
+	t->dead         = false;
+
+	if (Qt::CoarseTimer == type) {
+		if (interval >= Q_INT64_C(20000000000)) {
+			info->type = Qt::VeryCoarseTimer;
+		}
+		else if (interval <= Q_INT64_C(20000000)) {
+			info->type = Qt::PreciseTimer;
+		}
+	}
+
+	calculateNextTimeout(info, now);
+
+	growTable(this->m_timers, timerId);
+	Q_ASSERT(!this->m_timers.at(timerId));
+	this->m_timers[timerId] = t;
+	this->armTimer(t);
+}
+
+void EventDispatcherIOUringPrivate::registerZeroTimer(int timerId, QObject* object)
+{
+	ZeroTimer* data  = this->m_zero_timer_pool.allocate();
+	data->object     = object;
+	data->prev       = this->m_zero_last;
+	data->next       = 0;
+	data->generation = this->m_zero_generation; // does not fire during the current pass
+	data->timerId    = timerId;
+	data->firing     = false;
+	data->dead       = false;
+
+	if (this->m_zero_last) {
+		this->m_zero_last->next = data;
+	}
+	else {
+		this->m_zero_first = data;
+	}
+
+	this->m_zero_last = data;
+
+	growTable(this->m_zero_timers, timerId);
+	Q_ASSERT(!this->m_zero_timers.at(timerId));
+	this->m_zero_timers[timerId] = data;
+}
+
+void EventDispatcherIOUringPrivate::unregisterZeroTimer(ZeroTimer* data)
+{
+	this->m_zero_timers[data->timerId] = 0;
+
+	if (this->m_zero_dispatch_depth > 0) {
+		// activateZeroTimers() may be standing on this timer or on its neighbour, leave the list alone until it is done;
+		// the ID is free for reuse right away
+		data->dead = true;
+		++this->m_zero_dead;
+		return;
+	}
+
+	this->unlinkZeroTimer(data);
+}
+
+void EventDispatcherIOUringPrivate::unlinkZeroTimer(ZeroTimer* data)
+{
+	if (data->prev) {
+		data->prev->next = data->next;
+	}
+	else {
+		this->m_zero_first = data->next;
+	}
+
+	if (data->next) {
+		data->next->prev = data->prev;
+	}
+	else {
+		this->m_zero_last = data->prev;
+	}
+
+	this->m_zero_timer_pool.release(data);
+}
+
+bool EventDispatcherIOUringPrivate::activateZeroTimers(void)
+{
+	// Every pass has a newer generation than any timer it can find: timers registered during the pass
+	// and timers already fired by a nested event loop are recognized by the generation and skipped.
+	// This makes every zero timer fire once per iteration without copying the list or looking up the timers
+	const quint64 generation = ++this->m_zero_generation;
+	bool result = false;
+
+	++this->m_zero_dispatch_depth;
+	for (ZeroTimer* z = this->m_zero_first; z; z = z->next) {
+		if (!z->dead && !z->firing && z->generation < generation) {
+			z->generation = generation;
+			z->firing     = true;
+
+			QTimerEvent event(z->timerId);
+			QCoreApplication::sendEvent(z->object, &event);
+
+			z->firing = false;
+			result    = true;
+		}
+	}
+
+	if (0 == --this->m_zero_dispatch_depth && this->m_zero_dead) {
+		this->sweepZeroTimers();
+	}
+
+	return result;
+}
+
+void EventDispatcherIOUringPrivate::sweepZeroTimers(void)
+{
+	ZeroTimer* data = this->m_zero_first;
+	while (data) {
+		ZeroTimer* next = data->next;
+		if (data->dead) {
+			// The table entry has been cleared already and may belong to a new timer with the same ID by now
+			this->unlinkZeroTimer(data);
+		}
+
+		data = next;
+	}
+
+	this->m_zero_dead = 0;
+}
+
+void EventDispatcherIOUringPrivate::releaseTimer(URingTimer* t)
+{
+	this->m_timers[t->info.timerId] = 0;
+
+	if (t->in_flight) {
+		// Freed when the cancelled request completes
+		t->dead = true;
+		this->cancelTimer(t);
+	}
+	else {
+		this->m_timer_pool.release(t);
+	}
+}
+
+bool EventDispatcherIOUringPrivate::unregisterTimer(int timerId)
+{
+	URingTimer* t = this->timer(timerId);
+	if (t) {
+		this->releaseTimer(t);
+		return true;
+	}
+
+	ZeroTimer* data = this->zeroTimer(timerId);
+	if (data) {
+		this->unregisterZeroTimer(data);
+		return true;
+	}
+
+	return false;
+}
+
+bool EventDispatcherIOUringPrivate::unregisterTimers(QObject* object)
+{
+	bool result = false;
+	for (int i=0; i<this->m_timers.size(); ++i) {
+		URingTimer* t = this->m_timers.at(i);
+
+		if (t && object == t->info.object) {
+			result = true;
+			this->releaseTimer(t);
+		}
+	}
+
+	ZeroTimer* data = this->m_zero_first;
+	while (data) {
+		ZeroTimer* next = data->next;
+		if (object == data->object && !data->dead) {
+			result = true;
+			this->unregisterZeroTimer(data);
+		}
+
+		data = next;
+	}
+
+	return result;
+}
+
+QList<QAbstractEventDispatcher::TimerInfo> EventDispatcherIOUringPrivate::registeredTimers(QObject* object) const
+{
+	QList<QAbstractEventDispatcher::TimerInfo> res;
+
+	for (int i=0; i<this->m_timers.size(); ++i) {
+		const URingTimer* t = this->m_timers.at(i);
+
+		if (t && object == t->info.object) {
+#if QT_VERSION < 0x050000
+			QAbstractEventDispatcher::TimerInfo ti(t->info.timerId, timerIntervalMsec(&t->info));
+#else
+			QAbstractEventDispatcher::TimerInfo ti(t->info.timerId, timerIntervalMsec(&t->info), t->info.type);
+#endif
+			res.append(ti);
+		}
+	}
+
+	for (const ZeroTimer* data = this->m_zero_first; data; data = data->next) {
+		if (object == data->object && !data->dead) {
+#if QT_VERSION < 0x050000
+			QAbstractEventDispatcher::TimerInfo ti(data->timerId, 0);
+#else
+			QAbstractEventDispatcher::TimerInfo ti(data->timerId, 0, Qt::PreciseTimer);
+#endif
+			res.append(ti);
+		}
+	}
+
+	return res;
+}
+
+int EventDispatcherIOUringPrivate::remainingTime(int timerId) const
+{
+	const URingTimer* t = this->timer(timerId);
+	if (t) {
+		qint64 now = monotonicClock();
+		if (t->info.deadline <= now) {
+			return 0;
+		}
+
+		return static_cast<int>((t->info.deadline - now) / 1000000);
+	}
+
+	// A zero timer is always due
+	return this->zeroTimer(timerId) ? 0 : -1;
+}
+
+void EventDispatcherIOUringPrivate::activateTimers(void)
+{
+	// Timers are not re-armed until all handlers have run: an expired timer cannot fire again
+	// from a nested event loop, and handlers are free to (un)register timers while we are iterating
+	QVarLengthArray<int, 64> expired;
+	for (int i=0; i<this->m_expired.size(); ++i) {
+		expired.append(this->m_expired.at(i));
+	}
+
+	this->m_expired.resize(0);
+
+	for (int i=0; i<expired.size(); ++i) {
+		int tid       = expired.at(i);
+		URingTimer* t = this->timer(tid);
+		// The timer could have been killed (and its ID possibly reused) by one of the previous handlers
+		if (t && !t->in_flight) {
+			QTimerEvent event(tid);
+			QCoreApplication::sendEvent(t->info.object, &event);
+		}
+	}
+
+	const qint64 now = monotonicClock();
+	for (int i=0; i<expired.size(); ++i) {
+		URingTimer* t = this->timer(expired.at(i));
+		if (t && !t->in_flight) {
+			calculateNextTimeout(&t->info, now);
+			this->armTimer(t);
+		}
+	}
+}
+
+void EventDispatcherIOUringPrivate::armTimer(URingTimer* t)
+{
+	// The request is submitted later, so the timeout must not be relative; deadlines are monotonic like the kernel's clock
+	t->expires.tv_sec  = t->info.deadline / Q_INT64_C(1000000000);
+	t->expires.tv_nsec = t->info.deadline % Q_INT64_C(1000000000);
+	t->in_flight       = true;
+
+	struct io_uring_sqe* sqe = this->m_ring.sqe();
+	sqe->opcode        = IORING_OP_TIMEOUT;
+	sqe->fd            = -1;
+	sqe->addr          = reinterpret_cast<quintptr>(&t->expires);
+	sqe->len           = 1;
+	sqe->timeout_flags = IORING_TIMEOUT_ABS;
+	sqe->user_data     = quint64(reinterpret_cast<quintptr>(t)) | utTimer;
+}
+
+void EventDispatcherIOUringPrivate::cancelTimer(URingTimer* t)
+{
+	struct io_uring_sqe* sqe = this->m_ring.sqe();
+	sqe->opcode    = IORING_OP_TIMEOUT_REMOVE;
+	sqe->fd        = -1;
+	sqe->addr      = quint64(reinterpret_cast<quintptr>(t)) | utTimer;
+	sqe->user_data = utIgnore;
+}
+
+URingTimer* EventDispatcherIOUringPrivate::timer(int timerId) const
+{
+	return (timerId >= 0 && timerId < this->m_timers.size()) ? this->m_timers.at(timerId) : 0;
+}
+
+ZeroTimer* EventDispatcherIOUringPrivate::zeroTimer(int timerId) const
+{
+	return (timerId >= 0 && timerId < this->m_zero_timers.size()) ? this->m_zero_timers.at(timerId) : 0;
+}
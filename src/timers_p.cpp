@@ -1,19 +1,21 @@
 #include <QtCore/QCoreApplication>
 #include <QtCore/QEvent>
 #include <QtCore/QPair>
+#include <QtCore/QVarLengthArray>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
-#include <sys/time.h>
+#include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <unistd.h>
 #include "eventdispatcher_epoll_p.h"
 #include "qt4compat.h"
 
 namespace {
 
-	static void calculateCoarseTimerTimeout(TimerInfo* info, const struct timeval& now, struct timeval& when)
+	static qint64 calculateCoarseTimerTimeout(const TimerInfo* info, qint64 now)
 	{
-		Q_ASSERT(info->interval > 20);
+		Q_ASSERT(info->interval > Q_INT64_C(20000000));
 		// The coarse timer works like this:
 		//  - interval under 40 ms: round to even
 		//  - between 40 and 99 ms: round to multiple of 4
@@ -30,10 +32,10 @@ namespace {
 		//
 		// The objective is to make most timers wake up at the same time, thereby reducing CPU wakeups.
 
-		int interval     = info->interval;
-		int msec         = static_cast<int>(info->when.tv_usec / 1000);
+		int interval     = timerIntervalMsec(info);
+		qint64 sec       = info->when / Q_INT64_C(1000000000);
+		int msec         = static_cast<int>(info->when % Q_INT64_C(1000000000) / 1000000);
 		int max_rounding = interval / 20; // 5%
-		when             = info->when;
 
 		if (interval < 100 && (interval % 25) != 0) {
 			if (interval < 50) {
@@ -103,214 +105,359 @@ namespace {
 			}
 		}
 
-		if (msec == 1000) {
-			++when.tv_sec;
-			when.tv_usec = 0;
+		qint64 when = sec * Q_INT64_C(1000000000) + qint64(msec) * 1000000;
+		if (when < now) {
+			when += info->interval;
 		}
-		else {
-			when.tv_usec = msec * 1000;
+
+		Q_ASSERT(now <= when);
+		return when;
+	}
+}
+
+void calculateNextTimeout(TimerInfo* info, qint64 now)
+{
+	const qint64 interval = info->interval;
+	const qint64 second   = Q_INT64_C(1000000000);
+
+	if (interval) {
+		if (Q_UNLIKELY((interval < second && info->when - now > 3 * second / 2) || (interval >= second && info->when - now > interval + interval / 5))) {
+			info->when = now;
+		}
+	}
+
+	if (Qt::VeryCoarseTimer == info->type) {
+		qint64 sec = info->when / second;
+		if (info->when % second >= second / 2) {
+			++sec;
 		}
 
-		if (timercmp(&when, &now, <)) {
-			when.tv_sec  += interval / 1000;
-			when.tv_usec += (interval % 1000) * 1000;
-			if (when.tv_usec > 999999) {
-				++when.tv_sec;
-				when.tv_usec -= 1000000;
+		sec += interval / second;
+		if (Q_UNLIKELY(sec <= now / second)) {
+			sec = now / second + interval / second;
+		}
+
+		info->when     = sec * second;
+		info->deadline = info->when;
+	}
+	else if (Qt::PreciseTimer == info->type) {
+		if (interval) {
+			// Precise timers stay on their grid: if the event loop has been late, the missed periods are skipped
+			info->when += interval;
+			if (Q_UNLIKELY(info->when <= now)) {
+				info->when += ((now - info->when) / interval + 1) * interval;
 			}
+
+			info->deadline = info->when;
+		}
+		else {
+			info->deadline = now;
+		}
+	}
+	else {
+		info->when += interval;
+		if (Q_UNLIKELY(info->when < now)) {
+			info->when = now + interval;
 		}
 
-		Q_ASSERT(timercmp(&now, &when, <=));
+		info->deadline = calculateCoarseTimerTimeout(info, now);
 	}
+}
 
-	void calculateNextTimeout(TimerInfo* info, const struct timeval& now, struct timeval& delta)
+namespace {
+	template<typename T>
+	void heapSiftUp(QVector<T*>& heap, int idx)
 	{
-		struct timeval tv_interval;
-		struct timeval when;
-		tv_interval.tv_sec  = info->interval / 1000;
-		tv_interval.tv_usec = (info->interval % 1000) * 1000;
+		T* item = heap.at(idx);
+		while (idx > 0) {
+			int parent = (idx - 1) / 2;
+			T* tmp     = heap.at(parent);
+			if (!(item->deadline < tmp->deadline)) {
+				break;
+			}
+
+			heap[idx]  = tmp;
+			tmp->index = idx;
+			idx        = parent;
+		}
 
-		if (info->interval) {
-			qlonglong tnow  = (qlonglong(now.tv_sec)        * 1000) + (now.tv_usec        / 1000);
-			qlonglong twhen = (qlonglong(info->when.tv_sec) * 1000) + (info->when.tv_usec / 1000);
+		heap[idx]   = item;
+		item->index = idx;
+	}
 
-			if (Q_UNLIKELY((info->interval < 1000 && twhen - tnow > 1500) || (info->interval >= 1000 && twhen - tnow > 1.2*info->interval))) {
-				info->when = now;
+	template<typename T>
+	void heapSiftDown(QVector<T*>& heap, int idx)
+	{
+		int size = heap.size();
+		T* item  = heap.at(idx);
+		for (;;) {
+			int child = 2 * idx + 1;
+			if (child >= size) {
+				break;
 			}
-		}
 
-		if (Qt::VeryCoarseTimer == info->type) {
-			if (info->when.tv_usec >= 500000) {
-				++info->when.tv_sec;
+			T* c = heap.at(child);
+			if (child + 1 < size) {
+				T* r = heap.at(child + 1);
+				if (r->deadline < c->deadline) {
+					++child;
+					c = r;
+				}
 			}
 
-			info->when.tv_usec = 0;
-			info->when.tv_sec += info->interval / 1000;
-			if (Q_UNLIKELY(info->when.tv_sec <= now.tv_sec)) {
-				info->when.tv_sec = now.tv_sec + info->interval / 1000;
+			if (!(c->deadline < item->deadline)) {
+				break;
 			}
 
-			when = info->when;
+			heap[idx] = c;
+			c->index  = idx;
+			idx       = child;
 		}
-		else if (Qt::PreciseTimer == info->type) {
-			if (info->interval) {
-				timeradd(&info->when, &tv_interval, &info->when);
-				if (Q_UNLIKELY(timercmp(&info->when, &now, <))) {
-					timeradd(&now, &tv_interval, &info->when);
-				}
 
-				when = info->when;
-			}
-			else {
-				when = now;
-			}
+		heap[idx]   = item;
+		item->index = idx;
+	}
+
+	template<typename T>
+	void heapInsert(QVector<T*>& heap, T* item)
+	{
+		Q_ASSERT(-1 == item->index);
+
+		item->index = heap.size();
+		heap.append(item);
+		heapSiftUp(heap, item->index);
+	}
+
+	template<typename T>
+	void heapRemove(QVector<T*>& heap, T* item)
+	{
+		int idx = item->index;
+		if (-1 == idx) {
+			return;
 		}
-		else {
-			timeradd(&info->when, &tv_interval, &info->when);
-			if (Q_UNLIKELY(timercmp(&info->when, &now, <))) {
-				timeradd(&now, &tv_interval, &info->when);
-			}
 
-			calculateCoarseTimerTimeout(info, now, when);
+		item->index = -1;
+
+		T* last = heap.last();
+		heap.remove(heap.size() - 1);
+
+		if (last != item) {
+			heap[idx]   = last;
+			last->index = idx;
+			heapSiftUp(heap, idx);
+			heapSiftDown(heap, last->index);
 		}
+	}
 
-		timersub(&when, &now, &delta);
+	inline qint64 slotKey(qint64 deadline)
+	{
+		return deadline / 1000000;
+	}
+
+	inline int slotBucket(qint64 key, int buckets)
+	{
+		// Slot deadlines are multiples of the rounding boundaries, scramble the bits before masking
+		quint64 h = quint64(key) * Q_UINT64_C(0x9E3779B97F4A7C15);
+		return static_cast<int>(h >> 32) & (buckets - 1);
+	}
+
+	inline bool isScheduled(const TimerInfo* info)
+	{
+		return info->index != -1 || info->slot != 0;
 	}
 }
 
-void EventDispatcherEPollPrivate::registerTimer(int timerId, int interval, Qt::TimerType type, QObject* object)
+void EventDispatcherEPollPrivate::registerTimer(int timerId, qint64 interval, Qt::TimerType type, QObject* object)
 {
 	Q_ASSERT(interval > 0);
 
-	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
-	if (Q_LIKELY(fd != -1)) {
-		struct timeval now;
-		gettimeofday(&now, 0);
-
-		HandleData* data  = new HandleData();
-		data->type        = htTimer;
-		data->ti.object   = object;
-		data->ti.when     = now; // calculateNextTimeout() will take care of info->when
-		data->ti.timerId  = timerId;
-		data->ti.interval = interval;
-		data->ti.fd       = fd;
-		data->ti.type     = type;
-
-		if (Qt::CoarseTimer == type) {
-			if (interval >= 20000) {
-				data->ti.type = Qt::VeryCoarseTimer;
-			}
-			else if (interval <= 20) {
-				data->ti.type = Qt::PreciseTimer;
-			}
+	// The cached time could be as old as the handler that is registering the timer
+	const qint64 now = this->m_now = monotonicClock();
+
+	TimerInfo* info = this->m_timer_pool.allocate();
+	info->object    = object;
+	info->when      = now; // calculateNextTimeout() will take care of info->when
+	info->timerId   = timerId;
+	info->overruns  = 0;
+	info->interval  = interval;
+	info->index     = -1;
+	info->type      = type;
+	info->slot      = 0;
+	info->prev      = 0;
+	info->next      = 0;
+	info->expired   = false;
+	info->firing    = false;
+
+	if (Qt::CoarseTimer == type) {
+		if (interval >= Q_INT64_C(20000000000)) {
+			info->type = Qt::VeryCoarseTimer;
+		}
+		else if (interval <= Q_INT64_C(20000000)) {
+			info->type = Qt::PreciseTimer;
 		}
+	}
 
-		struct timeval delta;
-		calculateNextTimeout(&data->ti, now, delta);
+	calculateNextTimeout(info, now);
 
-		struct itimerspec spec;
-		spec.it_interval.tv_sec  = 0;
-		spec.it_interval.tv_nsec = 0;
+	growTable(this->m_timers, timerId);
+	Q_ASSERT(!this->m_timers.at(timerId));
+	this->m_timers[timerId] = info;
+	this->scheduleTimer(info);
+	this->rearmTimer();
+}
 
-		TIMEVAL_TO_TIMESPEC(&delta, &spec.it_value);
-		if (0 == spec.it_value.tv_sec && 0 == spec.it_value.tv_nsec) {
-			spec.it_value.tv_nsec = 500;
-		}
+void EventDispatcherEPollPrivate::registerZeroTimer(int timerId, QObject* object)
+{
+	ZeroTimer* data  = this->m_zero_timer_pool.allocate();
+	data->object     = object;
+	data->prev       = this->m_zero_last;
+	data->next       = 0;
+	data->generation = this->m_zero_generation; // does not fire during the current pass
+	data->timerId    = timerId;
+	data->firing     = false;
+	data->dead       = false;
+
+	if (this->m_zero_last) {
+		this->m_zero_last->next = data;
+	}
+	else {
+		this->m_zero_first = data;
+	}
 
-		if (Q_UNLIKELY(-1 == timerfd_settime(fd, 0, &spec, 0))) {
-			qErrnoWarning("%s: timerfd_settime() failed", Q_FUNC_INFO);
-			delete data;
-			close(fd);
-			return;
-		}
+	this->m_zero_last = data;
 
-		struct epoll_event event;
-		event.events  = EPOLLIN;
-		event.data.fd = fd;
+	growTable(this->m_zero_timers, timerId);
+	Q_ASSERT(!this->m_zero_timers.at(timerId));
+	this->m_zero_timers[timerId] = data;
+}
 
-		if (Q_UNLIKELY(-1 == epoll_ctl(this->m_epoll_fd, EPOLL_CTL_ADD, fd, &event))) {
-			qErrnoWarning("%s: epoll_ctl() failed", Q_FUNC_INFO);
-			delete data;
-			close(fd);
-			return;
-		}
+void EventDispatcherEPollPrivate::unregisterZeroTimer(ZeroTimer* data)
+{
+	this->m_zero_timers[data->timerId] = 0;
+
+	if (this->m_zero_dispatch_depth > 0) {
+		// activateZeroTimers() may be standing on this timer or on its neighbour, leave the list alone until it is done;
+		// the ID is free for reuse right away
+		data->dead = true;
+		++this->m_zero_dead;
+		return;
+	}
 
-		this->m_timers.insert(timerId, data);
-		this->m_handles.insert(fd, data);
+	this->unlinkZeroTimer(data);
+}
+
+void EventDispatcherEPollPrivate::unlinkZeroTimer(ZeroTimer* data)
+{
+	if (data->prev) {
+		data->prev->next = data->next;
 	}
 	else {
-		qErrnoWarning("%s: timerfd_create() failed", Q_FUNC_INFO);
+		this->m_zero_first = data->next;
 	}
-}
 
-void EventDispatcherEPollPrivate::registerZeroTimer(int timerId, QObject* object)
-{
-	ZeroTimer data;
-	data.object = object;
-	data.active = true;
-	this->m_zero_timers.insert(timerId, data);
+	if (data->next) {
+		data->next->prev = data->prev;
+	}
+	else {
+		this->m_zero_last = data->prev;
+	}
+
+	this->m_zero_timer_pool.release(data);
 }
 
-bool EventDispatcherEPollPrivate::unregisterTimer(int timerId)
+bool EventDispatcherEPollPrivate::activateZeroTimers(void)
 {
-	TimerHash::Iterator it = this->m_timers.find(timerId);
-	if (it != this->m_timers.end()) {
-		HandleData* data = it.value();
+	// Every pass has a newer generation than any timer it can find: timers registered during the pass
+	// and timers already fired by a nested event loop are recognized by the generation and skipped.
+	// This makes every zero timer fire once per iteration without copying the list or looking up the timers
+	const quint64 generation = ++this->m_zero_generation;
+	bool result = false;
 
-		int fd = data->ti.fd;
+	++this->m_zero_dispatch_depth;
+	for (ZeroTimer* z = this->m_zero_first; z; z = z->next) {
+		if (!z->dead && !z->firing && z->generation < generation) {
+			z->generation = generation;
+			z->firing     = true;
+
+			if (Q_UNLIKELY(this->m_stats_enabled)) {
+				++this->m_stats.zero_timer_events;
+			}
+
+			QTimerEvent event(z->timerId);
+			this->deliverEvent(z->object, &event, EventDispatcherEPoll::SlowHandlerReport::ZeroTimer, z->timerId);
+
+			z->firing = false;
+			result    = true;
+		}
+	}
+
+	if (0 == --this->m_zero_dispatch_depth && this->m_zero_dead) {
+		this->sweepZeroTimers();
+	}
+
+	return result;
+}
 
-		if (Q_UNLIKELY(-1 == epoll_ctl(this->m_epoll_fd, EPOLL_CTL_DEL, fd, 0))) {
-			qErrnoWarning("%s: epoll_ctl() failed", Q_FUNC_INFO);
+void EventDispatcherEPollPrivate::sweepZeroTimers(void)
+{
+	ZeroTimer* data = this->m_zero_first;
+	while (data) {
+		ZeroTimer* next = data->next;
+		if (data->dead) {
+			// The table entry has been cleared already and may belong to a new timer with the same ID by now
+			this->unlinkZeroTimer(data);
 		}
 
-		close(fd);
+		data = next;
+	}
 
-		this->m_timers.erase(it); // Hash is not rehashed
-		this->m_handles.remove(fd);
+	this->m_zero_dead = 0;
+}
 
-		delete data;
+bool EventDispatcherEPollPrivate::unregisterTimer(int timerId)
+{
+	TimerInfo* info = this->timer(timerId);
+	if (info) {
+		// The timer fd is not touched: if the timer was the nearest one, timer_callback() will simply find nothing to do
+		this->unscheduleTimer(info);
+		this->m_timers[timerId] = 0;
+		this->m_timer_pool.release(info);
 		return true;
 	}
 
-	return this->m_zero_timers.remove(timerId) > 0;
+	ZeroTimer* data = this->zeroTimer(timerId);
+	if (data) {
+		this->unregisterZeroTimer(data);
+		return true;
+	}
+
+	return false;
 }
 
 bool EventDispatcherEPollPrivate::unregisterTimers(QObject* object)
 {
 	bool result = false;
-	TimerHash::Iterator it = this->m_timers.begin();
-	while (it != this->m_timers.end()) {
-		HandleData* data = it.value();
+	for (int i=0; i<this->m_timers.size(); ++i) {
+		TimerInfo* info = this->m_timers.at(i);
 
-		if (object == data->ti.object) {
+		if (info && object == info->object) {
 			result = true;
-			int fd = data->ti.fd;
-
-			if (Q_UNLIKELY(-1 == epoll_ctl(this->m_epoll_fd, EPOLL_CTL_DEL, fd, 0))) {
-				qErrnoWarning("%s: epoll_ctl() failed", Q_FUNC_INFO);
-			}
 
-			close(fd);
-			delete data;
-
-			it = this->m_timers.erase(it); // Hash is not rehashed
-			this->m_handles.remove(fd);
-		}
-		else {
-			++it;
+			this->unscheduleTimer(info);
+			this->m_timers[i] = 0;
+			this->m_timer_pool.release(info);
 		}
 	}
 
-	ZeroTimerHash::Iterator zit = this->m_zero_timers.begin();
-	while (zit != this->m_zero_timers.end()) {
-		ZeroTimer& data = zit.value();
-		if (object == data.object) {
+	ZeroTimer* data = this->m_zero_first;
+	while (data) {
+		ZeroTimer* next = data->next;
+		if (object == data->object && !data->dead) {
 			result = true;
-			zit    = this->m_zero_timers.erase(zit);
-		}
-		else {
-			++zit;
+			this->unregisterZeroTimer(data);
 		}
+
+		data = next;
 	}
 
 	return result;
@@ -320,144 +467,372 @@ QList<QAbstractEventDispatcher::TimerInfo> EventDispatcherEPollPrivate::register
 {
 	QList<QAbstractEventDispatcher::TimerInfo> res;
 
-	TimerHash::ConstIterator it = this->m_timers.constBegin();
-	while (it != this->m_timers.constEnd()) {
-		HandleData* data = it.value();
+	for (int i=0; i<this->m_timers.size(); ++i) {
+		const TimerInfo* info = this->m_timers.at(i);
 
-		if (object == data->ti.object) {
+		if (info && object == info->object) {
 #if QT_VERSION < 0x050000
-			QAbstractEventDispatcher::TimerInfo ti(it.key(), data->ti.interval);
+			QAbstractEventDispatcher::TimerInfo ti(info->timerId, timerIntervalMsec(info));
 #else
-			QAbstractEventDispatcher::TimerInfo ti(it.key(), data->ti.interval, data->ti.type);
+			QAbstractEventDispatcher::TimerInfo ti(info->timerId, timerIntervalMsec(info), info->type);
 #endif
 			res.append(ti);
 		}
-
-		++it;
 	}
 
-	ZeroTimerHash::ConstIterator zit = this->m_zero_timers.constBegin();
-	while (zit != this->m_zero_timers.constEnd()) {
-		const ZeroTimer& data = zit.value();
-		if (object == data.object) {
+	for (const ZeroTimer* data = this->m_zero_first; data; data = data->next) {
+		if (object == data->object && !data->dead) {
 #if QT_VERSION < 0x050000
-			QAbstractEventDispatcher::TimerInfo ti(it.key(), 0);
+			QAbstractEventDispatcher::TimerInfo ti(data->timerId, 0);
 #else
-			QAbstractEventDispatcher::TimerInfo ti(it.key(), 0, Qt::PreciseTimer);
+			QAbstractEventDispatcher::TimerInfo ti(data->timerId, 0, Qt::PreciseTimer);
 #endif
 			res.append(ti);
 		}
-
-		++zit;
 	}
 
 	return res;
 }
 
+int EventDispatcherEPollPrivate::timerOverruns(int timerId) const
+{
+	const TimerInfo* info = this->timer(timerId);
+	return info ? info->overruns : -1;
+}
+
 int EventDispatcherEPollPrivate::remainingTime(int timerId) const
 {
-	TimerHash::ConstIterator it = this->m_timers.find(timerId);
-	if (it != this->m_timers.end()) {
-		HandleData* data = it.value();
+	// No clock read: the time of the current iteration is precise enough for a millisecond result.
+	// Timers suspended by X11ExcludeTimers keep their deadlines and report 0 once these have passed
+	const TimerInfo* info = this->timer(timerId);
+	if (info) {
+		if (info->deadline <= this->m_now) {
+			return 0;
+		}
 
-		struct timeval when;
-		struct itimerspec spec;
+		return static_cast<int>((info->deadline - this->m_now) / 1000000);
+	}
 
-		if (!data->ti.interval) {
-			return -1;
+	// A zero timer is always due
+	return this->zeroTimer(timerId) ? 0 : -1;
+}
+
+void EventDispatcherEPollPrivate::timer_callback(void)
+{
+	this->drainTimerFd();
+	this->activateTimers();
+}
+
+void EventDispatcherEPollPrivate::activateTimers(void)
+{
+	this->m_timers_pending = false;
+
+	const qint64 now = this->m_now;
+
+	// Detach all expired timers from the heap and the slots first, handlers are free to (un)register timers
+	// while we are iterating. The queue is shared with nested event loops started by the handlers: they fire
+	// the timers this pass has not got to yet, but not a timer whose handler is still running
+	for (;;) {
+		TimerInfo* info = this->m_timer_heap.isEmpty() ? 0 : this->m_timer_heap.first();
+		TimerSlot* slot = this->m_slot_heap.isEmpty()  ? 0 : this->m_slot_heap.first();
+
+		if (slot && (!info || slot->deadline < info->deadline)) {
+			if (slot->deadline > now) {
+				break;
+			}
+
+			// The whole slot expires at once, no matter how many timers it holds
+			TimerInfo* i = slot->first;
+			while (i) {
+				TimerInfo* next = i->next;
+				this->m_expired.append(i->timerId);
+				i->expired = true;
+				i->slot    = 0;
+				i->prev    = 0;
+				i->next    = 0;
+				i          = next;
+			}
+
+			slot->first = 0;
+			slot->last  = 0;
+
+			this->removeSlot(slot);
 		}
+		else if (info) {
+			if (info->deadline > now) {
+				break;
+			}
 
-		if (Q_UNLIKELY(-1 == timerfd_gettime(data->ti.fd, &spec))) {
-			qErrnoWarning("%s: timerfd_gettime() failed", Q_FUNC_INFO);
-			return -1;
+			this->m_expired.append(info->timerId);
+			info->expired = true;
+			heapRemove(this->m_timer_heap, info);
+		}
+		else {
+			break;
 		}
+	}
 
-		Q_ASSERT(!(spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0));
+	// The timer fd must serve the timers still scheduled before any handler gets a chance to start a nested event loop
+	this->rearmTimer();
 
-		TIMESPEC_TO_TIMEVAL(&when, &spec.it_value);
-		return static_cast<int>((qulonglong(when.tv_sec) * 1000000 + when.tv_usec) / 1000);
-	}
+	while (this->m_expired_head < this->m_expired.size()) {
+		const int tid   = this->m_expired.at(this->m_expired_head++);
+		TimerInfo* info = this->timer(tid);
+		// The timer could have been killed (and its ID possibly reused) by one of the previous handlers
+		if (!info || !info->expired) {
+			continue;
+		}
+
+		info->expired = false;
+		info->firing  = true;
 
-	// For zero timers we return -1 as well
+		if (Q_UNLIKELY(this->m_stats_enabled)) {
+			this->countTimerEvent(info, now);
+		}
+
+		// The periods the timer has missed are skipped by calculateNextTimeout() and reported here
+		if (Qt::PreciseTimer == info->type) {
+			info->overruns = static_cast<int>(qMin((now - info->deadline) / info->interval, qint64(INT_MAX)));
+		}
 
-	return -1;
+		QTimerEvent event(tid);
+		this->deliverEvent(info->object, &event, EventDispatcherEPoll::SlowHandlerReport::Timer, tid);
+
+		// The handlers take some time, but the timer fd is armed with absolute deadlines:
+		// at worst a deadline computed against the cached time is already in the past and fires right away
+		info = this->timer(tid);
+		if (info && info->firing) {
+			info->firing = false;
+			calculateNextTimeout(info, this->m_now);
+			this->scheduleTimer(info);
+			this->rearmTimer();
+		}
+	}
+
+	this->m_expired.resize(0);
+	this->m_expired_head = 0;
 }
 
-void EventDispatcherEPollPrivate::timer_callback(const TimerInfo& info)
+void EventDispatcherEPollPrivate::drainTimerFd(void)
 {
 	uint64_t value;
 	int res;
 	do {
-		res = read(info.fd, &value, sizeof(value));
+		res = read(this->m_timer_fd, &value, sizeof(value));
 	} while (-1 == res && EINTR == errno);
 
-	if (Q_UNLIKELY(-1 == res)) {
+	if (Q_UNLIKELY(-1 == res && EAGAIN != errno)) {
 		qErrnoWarning("%s: read() failed", Q_FUNC_INFO);
 	}
 
-	int tid = info.timerId;
-	QTimerEvent event(tid);
-	QCoreApplication::sendEvent(info.object, &event);
+	if (!this->m_timer_interval) {
+		this->m_timer_armed = false;
+	}
+	else if (sizeof(value) == res) {
+		// The kernel has re-armed the timer fd for the period after the last expiration it has counted
+		this->m_timer_deadline += qint64(value) * this->m_timer_interval;
+	}
+}
+
+void EventDispatcherEPollPrivate::rearmTimer(void)
+{
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+
+	const qint64* deadline = this->nextDeadline();
+	if (!deadline) {
+		// If the timer fd is still armed as a one shot timer, we will get one spurious wakeup; this is cheaper than a syscall.
+		// A periodic one would keep waking us up
+		if (this->m_timer_armed && this->m_timer_interval) {
+			if (Q_UNLIKELY(-1 == timerfd_settime(this->m_timer_fd, 0, &spec, 0))) {
+				qErrnoWarning("%s: timerfd_settime() failed", Q_FUNC_INFO);
+			}
 
-	TimerHash::Iterator it = this->m_timers.find(tid);
-	if (it != this->m_timers.end()) {
-		HandleData* data = it.value();
+			this->m_timer_armed    = false;
+			this->m_timer_interval = 0;
+		}
 
-		struct timeval now;
-		struct timeval delta;
-		struct itimerspec spec;
+		return;
+	}
 
-		spec.it_interval.tv_sec  = 0;
-		spec.it_interval.tv_nsec = 0;
+	// When the nearest timer is a precise one, the timer fd gets its period: as long as the timer stays the nearest one
+	// and keeps up, the kernel re-arms the timer fd for its next expiration and this function has nothing to do
+	const TimerInfo* front = this->m_timer_heap.isEmpty() ? 0 : this->m_timer_heap.at(0);
+	const qint64 interval  = (front && deadline == &front->deadline) ? front->interval : 0;
 
-		gettimeofday(&now, 0);
-		calculateNextTimeout(&data->ti, now, delta);
-		TIMEVAL_TO_TIMESPEC(&delta, &spec.it_value);
-		if (0 == spec.it_value.tv_sec && 0 == spec.it_value.tv_nsec) {
-			spec.it_value.tv_nsec = 500;
-		}
+	if (this->m_timer_armed && *deadline == this->m_timer_deadline && interval == this->m_timer_interval) {
+		return;
+	}
 
-		if (-1 == timerfd_settime(data->ti.fd, 0, &spec, 0)) {
-			qErrnoWarning("%s: timerfd_settime() failed", Q_FUNC_INFO);
-		}
+	// An absolute deadline needs no clock read, and one in the past fires right away
+	spec.it_value.tv_sec     = *deadline / Q_INT64_C(1000000000);
+	spec.it_value.tv_nsec    = *deadline % Q_INT64_C(1000000000);
+	spec.it_interval.tv_sec  = interval / Q_INT64_C(1000000000);
+	spec.it_interval.tv_nsec = interval % Q_INT64_C(1000000000);
+
+	if (Q_UNLIKELY(-1 == timerfd_settime(this->m_timer_fd, TFD_TIMER_ABSTIME, &spec, 0))) {
+		qErrnoWarning("%s: timerfd_settime() failed", Q_FUNC_INFO);
+		return;
 	}
+
+	this->m_timer_armed    = true;
+	this->m_timer_deadline = *deadline;
+	this->m_timer_interval = interval;
 }
 
-bool EventDispatcherEPollPrivate::disableTimers(bool disable)
+void EventDispatcherEPollPrivate::scheduleTimer(TimerInfo* info)
 {
-	struct timeval now;
-	struct itimerspec spec;
+	Q_ASSERT(!isScheduled(info));
 
-	if (!disable) {
-		gettimeofday(&now, 0);
+	if (Qt::PreciseTimer == info->type) {
+		heapInsert(this->m_timer_heap, info);
+		return;
+	}
+
+	// Coarse timers are rounded to a handful of boundaries by calculateCoarseTimerTimeout(),
+	// therefore lots of them share the deadline: link the timer into the slot for that deadline
+	qint64 key      = slotKey(info->deadline);
+	TimerSlot* slot = this->findSlot(key);
+	if (!slot) {
+		slot           = this->m_slot_pool.allocate();
+		slot->deadline = info->deadline;
+		slot->key      = key;
+		slot->index    = -1;
+		slot->first    = 0;
+		slot->last     = 0;
+
+		this->insertSlot(slot);
+	}
+
+	info->slot = slot;
+	info->prev = slot->last;
+	info->next = 0;
+
+	if (slot->last) {
+		slot->last->next = info;
 	}
 	else {
-		spec.it_value.tv_sec  = 0;
-		spec.it_value.tv_nsec = 0;
+		slot->first = info;
 	}
 
-	spec.it_interval.tv_sec  = 0;
-	spec.it_interval.tv_nsec = 0;
+	slot->last = info;
+}
 
-	TimerHash::Iterator it = this->m_timers.begin();
-	while (it != this->m_timers.end()) {
-		HandleData* data = it.value();
+void EventDispatcherEPollPrivate::unscheduleTimer(TimerInfo* info)
+{
+	if (Qt::PreciseTimer == info->type) {
+		heapRemove(this->m_timer_heap, info);
+		return;
+	}
 
-		if (!disable) {
-			struct timeval delta;
-			calculateNextTimeout(&data->ti, now, delta);
-			TIMEVAL_TO_TIMESPEC(&delta, &spec.it_value);
-			if (0 == spec.it_value.tv_sec && 0 == spec.it_value.tv_nsec) {
-				spec.it_value.tv_nsec = 500;
-			}
+	TimerSlot* slot = info->slot;
+	if (!slot) {
+		return;
+	}
+
+	if (info->prev) {
+		info->prev->next = info->next;
+	}
+	else {
+		slot->first = info->next;
+	}
+
+	if (info->next) {
+		info->next->prev = info->prev;
+	}
+	else {
+		slot->last = info->prev;
+	}
+
+	info->slot = 0;
+	info->prev = 0;
+	info->next = 0;
+
+	if (!slot->first) {
+		this->removeSlot(slot);
+	}
+}
+
+const qint64* EventDispatcherEPollPrivate::nextDeadline(void) const
+{
+	const qint64* res = 0;
+
+	if (!this->m_timer_heap.isEmpty()) {
+		res = &this->m_timer_heap.at(0)->deadline;
+	}
+
+	if (!this->m_slot_heap.isEmpty()) {
+		const qint64* d = &this->m_slot_heap.at(0)->deadline;
+		if (!res || *d < *res) {
+			res = d;
 		}
+	}
+
+	return res;
+}
+
+TimerInfo* EventDispatcherEPollPrivate::timer(int timerId) const
+{
+	return (timerId >= 0 && timerId < this->m_timers.size()) ? this->m_timers.at(timerId) : 0;
+}
+
+ZeroTimer* EventDispatcherEPollPrivate::zeroTimer(int timerId) const
+{
+	return (timerId >= 0 && timerId < this->m_zero_timers.size()) ? this->m_zero_timers.at(timerId) : 0;
+}
+
+TimerSlot* EventDispatcherEPollPrivate::findSlot(qint64 key) const
+{
+	if (this->m_slots.isEmpty()) {
+		return 0;
+	}
 
-		if (Q_UNLIKELY(-1 == timerfd_settime(data->ti.fd, 0, &spec, 0))) {
-			qErrnoWarning("%s: timerfd_settime() failed", Q_FUNC_INFO);
+	TimerSlot* slot = this->m_slots.at(slotBucket(key, this->m_slots.size()));
+	while (slot && slot->key != key) {
+		slot = slot->hash_next;
+	}
+
+	return slot;
+}
+
+void EventDispatcherEPollPrivate::insertSlot(TimerSlot* slot)
+{
+	if (this->m_slot_count >= this->m_slots.size()) {
+		// Keep the load factor under 1; the old buckets are relinked, slots themselves never move
+		int size = qMax(64, 2 * this->m_slots.size());
+		TimerSlotHash buckets(size, static_cast<TimerSlot*>(0));
+		for (int i=0; i<this->m_slots.size(); ++i) {
+			TimerSlot* s = this->m_slots.at(i);
+			while (s) {
+				TimerSlot* next = s->hash_next;
+				int b           = slotBucket(s->key, size);
+				s->hash_next    = buckets.at(b);
+				buckets[b]      = s;
+				s               = next;
+			}
 		}
 
-		++it;
+		this->m_slots = buckets;
 	}
 
-	return true;
+	int b           = slotBucket(slot->key, this->m_slots.size());
+	slot->hash_next = this->m_slots.at(b);
+	this->m_slots[b] = slot;
+	++this->m_slot_count;
+
+	heapInsert(this->m_slot_heap, slot);
+}
+
+void EventDispatcherEPollPrivate::removeSlot(TimerSlot* slot)
+{
+	TimerSlot** p = &this->m_slots[slotBucket(slot->key, this->m_slots.size())];
+	while (*p != slot) {
+		p = &(*p)->hash_next;
+	}
+
+	*p = slot->hash_next;
+	--this->m_slot_count;
+
+	heapRemove(this->m_slot_heap, slot);
+	this->m_slot_pool.release(slot);
 }
@@ -0,0 +1,1870 @@
+#include <QtCore/QAbstractEventDispatcher>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QEvent>
+#include <QtCore/QSocketNotifier>
+#include <QtCore/QThread>
+#include <QtTest/QTest>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "eventdispatcher_epoll.h"
+#include "eventdispatcher_epoll_group.h"
+
+#ifdef EVENTDISPATCHER_EPOLL_CXX11
+#	include <memory>
+#endif
+
+// Behaviour specific to EventDispatcherEPoll; the generic dispatcher tests live in qt_eventdispatcher_tests
+
+namespace {
+
+EventDispatcherEPoll* threadDispatcher(void)
+{
+	return qobject_cast<EventDispatcherEPoll*>(QAbstractEventDispatcher::instance());
+}
+
+bool makeSocketPair(int* fds)
+{
+	return 0 == socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds);
+}
+
+void drain(int fd)
+{
+	char buf[64];
+	while (read(fd, buf, sizeof(buf)) > 0) {
+	}
+}
+
+// Timers started with QObject::startTimer() and registerPreciseTimer() go to the thread's dispatcher.
+// This gives a test the thread's dispatcher with the statistics enabled and puts the settings back afterwards
+class ThreadDispatcher {
+public:
+	ThreadDispatcher(void) : m_d(threadDispatcher()) { this->m_d->setStatisticsEnabled(true); }
+
+	~ThreadDispatcher(void)
+	{
+		this->m_d->setBusyPolling(0);
+		this->m_d->setDispatchBudget(0);
+		this->m_d->setSlowHandlerWatchdog(0, 0);
+		this->m_d->setEdgeTriggered(false);
+		this->m_d->setStatisticsEnabled(false);
+	}
+
+	EventDispatcherEPoll* operator->(void) const { return this->m_d; }
+
+private:
+	EventDispatcherEPoll* m_d;
+};
+
+quint64 timerEvents(const EventDispatcherEPoll::Statistics& stats)
+{
+	return stats.timer_events[0] + stats.timer_events[1] + stats.timer_events[2];
+}
+
+qint64 monotonicMsecs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return qint64(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// The interval registeredTimers() reports for the only timer of object, -1 if it does not have exactly one
+int registeredInterval(QObject* object)
+{
+	QList<QAbstractEventDispatcher::TimerInfo> timers = threadDispatcher()->registeredTimers(object);
+	if (timers.size() != 1) {
+		return -1;
+	}
+
+#if QT_VERSION >= 0x050000
+	return timers.at(0).interval;
+#else
+	return timers.at(0).second;
+#endif
+}
+
+// Also records what timerOverruns() says from within the handler
+class TimerCounter : public QObject {
+public:
+	TimerCounter(void) : fires(0), overruns(-1) {}
+
+	int fires;
+	int overruns;
+
+protected:
+	virtual void timerEvent(QTimerEvent* e)
+	{
+		++this->fires;
+		this->overruns = threadDispatcher()->timerOverruns(e->timerId());
+	}
+};
+
+// Runs a nested event loop from its first timer event until the other timer fires or 500 ms pass
+class NestingTimer : public QObject {
+public:
+	explicit NestingTimer(TimerCounter* other) : fires(0), nested_fires(0), m_other(other) {}
+
+	int fires;
+	int nested_fires; // of the other timer
+
+protected:
+	virtual void timerEvent(QTimerEvent*)
+	{
+		if (++this->fires > 1) {
+			return;
+		}
+
+		const int before   = this->m_other->fires;
+		const qint64 start = monotonicMsecs();
+		while (this->m_other->fires == before && monotonicMsecs() - start < 500) {
+			threadDispatcher()->processEvents(QEventLoop::AllEvents);
+			QTest::qSleep(1);
+		}
+
+		this->nested_fires = this->m_other->fires - before;
+	}
+
+private:
+	TimerCounter* m_other;
+};
+
+// Zero timers are registered with the dispatcher directly, so that a handler can register one again under the same ID;
+// a zero ID allocates a new one
+int registerZeroTimer(int id, QObject* object)
+{
+	QAbstractEventDispatcher* d = threadDispatcher();
+#if QT_VERSION >= 0x050000
+	if (!id) {
+		return d->registerTimer(0, Qt::CoarseTimer, object);
+	}
+
+	d->registerTimer(id, 0, Qt::CoarseTimer, object);
+#else
+	if (!id) {
+		return d->registerTimer(0, object);
+	}
+
+	d->registerTimer(id, 0, object);
+#endif
+	return id;
+}
+
+// A zero timer whose handler unregisters its target (itself by default), registers the target again under the same ID,
+// or runs a nested event loop on its first event
+class ZeroTimerObject : public QObject {
+public:
+	enum Action { Nothing, Unregister, Reregister, Nest };
+
+	explicit ZeroTimerObject(Action a = Nothing) : id(registerZeroTimer(0, this)), fires(0), action(a), target(this) {}
+	~ZeroTimerObject(void) { threadDispatcher()->unregisterTimers(this); }
+
+	int id;
+	int fires;
+	Action action;
+	ZeroTimerObject* target;
+
+protected:
+	virtual void timerEvent(QTimerEvent*)
+	{
+		++this->fires;
+		switch (this->action) {
+			case Unregister:
+				threadDispatcher()->unregisterTimer(this->target->id);
+				break;
+
+			case Reregister:
+				threadDispatcher()->unregisterTimer(this->target->id);
+				registerZeroTimer(this->target->id, this->target);
+				break;
+
+			case Nest:
+				if (1 == this->fires) {
+					threadDispatcher()->processEvents(QEventLoop::AllEvents);
+				}
+
+				break;
+
+			default:
+				break;
+		}
+	}
+};
+
+// Records the signals delivered to a watch
+struct SignalLog {
+	QList<int> signos;
+	QList<int> values;
+};
+
+void logSignal(const struct signalfd_siginfo& info, void* context)
+{
+	SignalLog* log = static_cast<SignalLog*>(context);
+	log->signos.append(static_cast<int>(info.ssi_signo));
+	log->values.append(info.ssi_int);
+}
+
+void raiseSignal(int signo)
+{
+	pthread_kill(pthread_self(), signo);
+}
+
+// Removes an instance of a blocked signal left pending, returns false if there is none
+bool takePendingSignal(int signo)
+{
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, signo);
+
+	struct timespec ts = { 0, 0 };
+	return sigtimedwait(&set, 0, &ts) == signo;
+}
+
+// Records the events delivered to a descriptor watcher
+struct DescriptorLog {
+	QList<int> fds;
+	QList<uint> events;
+};
+
+void logDescriptor(int fd, uint events, void* context)
+{
+	DescriptorLog* log = static_cast<DescriptorLog*>(context);
+	log->fds.append(fd);
+	log->events.append(events);
+}
+
+// The events an epoll set of the process has for fd according to /proc, 0 if fd is in none
+uint registeredEvents(int fd)
+{
+	uint res  = 0;
+	DIR* dir  = opendir("/proc/self/fdinfo");
+	if (!dir) {
+		return res;
+	}
+
+	struct dirent* entry;
+	while (!res && (entry = readdir(dir)) != 0) {
+		char path[64];
+		snprintf(path, sizeof(path), "/proc/self/fdinfo/%s", entry->d_name);
+		FILE* f = fopen(path, "r");
+		if (!f) {
+			continue;
+		}
+
+		char line[256];
+		while (fgets(line, sizeof(line), f)) {
+			int tfd;
+			uint events;
+			if (2 == sscanf(line, "tfd: %d events: %x", &tfd, &events) && tfd == fd) {
+				res = events;
+				break;
+			}
+		}
+
+		fclose(f);
+	}
+
+	closedir(dir);
+	return res;
+}
+
+// Shares and unshares a descriptor over and over
+class SharingThread : public QThread {
+public:
+	SharingThread(EventDispatcherEPollGroup* group, int fd) : m_group(group), m_fd(fd) {}
+
+protected:
+	virtual void run(void)
+	{
+		for (int i=0; i<1000; ++i) {
+			this->m_group->removeSharedDescriptor(this->m_fd);
+			this->m_group->addSharedDescriptor(this->m_fd);
+		}
+	}
+
+private:
+	EventDispatcherEPollGroup* m_group;
+	int m_fd;
+};
+
+// Counts activations and reads the descriptor dry, so that a level-triggered notifier is not activated again
+class ReadNotifier : public QSocketNotifier {
+public:
+	explicit ReadNotifier(int fd) : QSocketNotifier(fd, QSocketNotifier::Read), activations(0) {}
+
+	int activations;
+
+protected:
+	virtual bool event(QEvent* e)
+	{
+		if (e->type() == QEvent::SockAct) {
+			++this->activations;
+			drain(static_cast<int>(this->socket()));
+			return true;
+		}
+
+		return QSocketNotifier::event(e);
+	}
+};
+
+// On its first activation, deletes its partner and reuses the partner's descriptor number for a new connection
+// with a notifier of its own; *served tells which of the two has survived
+class ReplacingNotifier : public QSocketNotifier {
+public:
+	ReplacingNotifier(int fd, ReplacingNotifier** served)
+		: QSocketNotifier(fd, QSocketNotifier::Read), activations(0), partner(0), fresh(0), peer(-1), m_served(served)
+	{
+	}
+
+	int activations;
+	ReplacingNotifier* partner;
+	ReadNotifier* fresh;
+	int peer; // the other end of the new connection
+
+protected:
+	virtual bool event(QEvent* e)
+	{
+		if (e->type() == QEvent::SockAct) {
+			++this->activations;
+			drain(static_cast<int>(this->socket()));
+			if (this->partner) {
+				const int fd = static_cast<int>(this->partner->socket());
+				this->partner->partner = 0;
+				delete this->partner;
+				this->partner = 0;
+				*this->m_served = this;
+
+				int fds[2];
+				if (makeSocketPair(fds) && dup2(fds[0], fd) == fd) {
+					close(fds[0]);
+					this->peer  = fds[1];
+					this->fresh = new ReadNotifier(fd);
+				}
+			}
+
+			return true;
+		}
+
+		return QSocketNotifier::event(e);
+	}
+
+private:
+	ReplacingNotifier** m_served;
+};
+
+// Counts activations but leaves the data in place, so that the descriptor stays readable
+class CountingNotifier : public QSocketNotifier {
+public:
+	CountingNotifier(int fd, QSocketNotifier::Type type) : QSocketNotifier(fd, type), activations(0) {}
+
+	int activations;
+
+protected:
+	virtual bool event(QEvent* e)
+	{
+		if (e->type() == QEvent::SockAct) {
+			++this->activations;
+			return true;
+		}
+
+		return QSocketNotifier::event(e);
+	}
+};
+
+void logSlowHandler(const EventDispatcherEPoll::SlowHandlerReport& report, void* context)
+{
+	static_cast<QList<EventDispatcherEPoll::SlowHandlerReport>*>(context)->append(report);
+}
+
+// Takes its time over every timer event, and deletes itself afterwards if asked to
+class SleepingObject : public QObject {
+public:
+	SleepingObject(int msecs, bool suicide) : m_msecs(msecs), m_suicide(suicide) {}
+
+protected:
+	virtual void timerEvent(QTimerEvent*)
+	{
+		QTest::qSleep(this->m_msecs);
+		if (this->m_suicide) {
+			delete this;
+		}
+	}
+
+private:
+	int m_msecs;
+	bool m_suicide;
+};
+
+// Same for socket notifier activations; reads the descriptor dry first
+class SleepingNotifier : public QSocketNotifier {
+public:
+	SleepingNotifier(int fd, int msecs, bool suicide) : QSocketNotifier(fd, QSocketNotifier::Read), m_msecs(msecs), m_suicide(suicide) {}
+
+protected:
+	virtual bool event(QEvent* e)
+	{
+		if (e->type() == QEvent::SockAct) {
+			drain(static_cast<int>(this->socket()));
+			QTest::qSleep(this->m_msecs);
+			if (this->m_suicide) {
+				delete this;
+			}
+
+			return true;
+		}
+
+		return QSocketNotifier::event(e);
+	}
+
+private:
+	int m_msecs;
+	bool m_suicide;
+};
+
+#if QT_VERSION >= 0x040400
+// A posted task that appends its number to a list
+struct NumberedTask {
+	QList<int>* list;
+	int number;
+};
+
+void runNumberedTask(void* context)
+{
+	NumberedTask* task = static_cast<NumberedTask*>(context);
+	task->list->append(task->number);
+}
+
+class PostingThread : public QThread {
+public:
+	PostingThread(EventDispatcherEPoll* dispatcher, NumberedTask* tasks, int count)
+		: m_dispatcher(dispatcher), m_tasks(tasks), m_count(count)
+	{
+	}
+
+protected:
+	virtual void run(void)
+	{
+		// Let the dispatcher's thread block first
+		QTest::qSleep(20);
+		for (int i=0; i<this->m_count; ++i) {
+			this->m_dispatcher->post(runNumberedTask, &this->m_tasks[i]);
+		}
+	}
+
+private:
+	EventDispatcherEPoll* m_dispatcher;
+	NumberedTask* m_tasks;
+	int m_count;
+};
+
+class WakingThread : public QThread {
+public:
+	explicit WakingThread(EventDispatcherEPoll* dispatcher, int count = 1) : m_dispatcher(dispatcher), m_count(count) {}
+
+protected:
+	virtual void run(void)
+	{
+		// A single request is made once the dispatcher's thread is likely to wait for events
+		if (1 == this->m_count) {
+			QTest::qSleep(20);
+		}
+
+		for (int i=0; i<this->m_count; ++i) {
+			this->m_dispatcher->wakeUp();
+		}
+	}
+
+private:
+	EventDispatcherEPoll* m_dispatcher;
+	int m_count;
+};
+#endif
+
+}
+
+class tst_EventDispatcherEPoll : public QObject {
+	Q_OBJECT
+
+private Q_SLOTS:
+	void statisticsDisabledByDefault(void);
+	void statisticsCountIterations(void);
+	void statisticsReset(void);
+	void statisticsToggledWhileWaking(void);
+	void watchdogTimer(void);
+	void watchdogSocket(void);
+	void watchdogReceiverDeleted(void);
+	void busyPollingSetting(void);
+	void busyPollingOff(void);
+	void busyPollingHit(void);
+	void busyPollingMiss(void);
+	void busyPollingWakeUp(void);
+	void dispatchBudgetRoundRobin(void);
+	void dispatchBudgetDescriptorReuse(void);
+	void dispatchBudgetNotifierReplaced(void);
+	void descriptorReusedInBatch(void);
+	void notifierToggleCancelled(void);
+	void edgeTriggeredOnce(void);
+	void edgeTriggeredRearm(void);
+	void edgeTriggeredRearmShared(void);
+	void notifierToggleLastNotifier(void);
+	void postRunsTasksInOrder(void);
+	void postFromAnotherThread(void);
+	void postDiscardsTasksOnDestruction(void);
+	void preciseTimerSubMillisecond(void);
+	void preciseTimerInvalidArguments(void);
+	void preciseTimerChrono(void);
+	void timerOverrunsCoalesced(void);
+	void timerOverrunsOtherTimers(void);
+	void timerNestedLoop(void);
+	void zeroTimerUnregisterSelf(void);
+	void zeroTimerUnregisterNeighbours(void);
+	void zeroTimerReregistered(void);
+	void zeroTimerNestedLoop(void);
+	void signalWatch(void);
+	void signalReplace(void);
+	void signalUnwatch(void);
+	void signalRejected(void);
+	void signalBatch(void);
+	void signalFunction(void);
+	void watcherCallback(void);
+	void watcherInterestSet(void);
+	void watcherReplace(void);
+	void watcherHangup(void);
+	void watcherOneShot(void);
+	void watcherUnwatch(void);
+	void watcherExcludesNotifiers(void);
+	void watcherFunction(void);
+	void groupMembership(void);
+	void groupSharedDescriptor(void);
+	void groupUpdateWhileRunning(void);
+};
+
+void tst_EventDispatcherEPoll::statisticsDisabledByDefault(void)
+{
+	EventDispatcherEPoll d;
+	QVERIFY(!d.isStatisticsEnabled());
+
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(d.statistics().iterations, Q_UINT64_C(0));
+}
+
+void tst_EventDispatcherEPoll::statisticsCountIterations(void)
+{
+	EventDispatcherEPoll d;
+	d.setStatisticsEnabled(true);
+	QVERIFY(d.isStatisticsEnabled());
+
+	for (int i=0; i<3; ++i) {
+		d.processEvents(QEventLoop::AllEvents);
+	}
+
+	EventDispatcherEPoll::Statistics stats = d.statistics();
+	QCOMPARE(stats.iterations, Q_UINT64_C(3));
+	QVERIFY(stats.epoll_waits >= 3);
+
+	// The loop is not blocked: the request is counted, but nothing is written to the eventfd
+	d.wakeUp();
+	d.processEvents(QEventLoop::AllEvents);
+
+	stats = d.statistics();
+	QCOMPARE(stats.wakeups_requested, Q_UINT64_C(1));
+	QCOMPARE(stats.wakeups_written, Q_UINT64_C(0));
+}
+
+void tst_EventDispatcherEPoll::statisticsReset(void)
+{
+	EventDispatcherEPoll d;
+	d.setStatisticsEnabled(true);
+	d.processEvents(QEventLoop::AllEvents);
+	d.processEvents(QEventLoop::AllEvents);
+
+	// Enabling enabled statistics changes nothing
+	d.setStatisticsEnabled(true);
+	QCOMPARE(d.statistics().iterations, Q_UINT64_C(2));
+
+	// Disabled statistics are not updated, and enabling them again resets the counters
+	d.setStatisticsEnabled(false);
+	d.wakeUp();
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(d.statistics().iterations, Q_UINT64_C(2));
+
+	d.setStatisticsEnabled(true);
+	QCOMPARE(d.statistics().iterations, Q_UINT64_C(0));
+
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(d.statistics().wakeups_requested, Q_UINT64_C(0));
+}
+
+void tst_EventDispatcherEPoll::statisticsToggledWhileWaking(void)
+{
+#if QT_VERSION >= 0x040400
+	// Other threads count their wakeUp() calls while the dispatcher's thread switches the statistics on and off
+	EventDispatcherEPoll d;
+	WakingThread thread(&d, 1000);
+	thread.start();
+	for (int i=0; i<1000; ++i) {
+		d.setStatisticsEnabled(i & 1);
+		d.processEvents(QEventLoop::AllEvents);
+	}
+
+	thread.wait();
+	d.setStatisticsEnabled(false);
+	d.setStatisticsEnabled(true);
+	d.wakeUp();
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(d.statistics().wakeups_requested, Q_UINT64_C(1));
+#endif
+}
+
+void tst_EventDispatcherEPoll::watchdogTimer(void)
+{
+	ThreadDispatcher d;
+	QList<EventDispatcherEPoll::SlowHandlerReport> reports;
+	d->setSlowHandlerWatchdog(2000, logSlowHandler, &reports);
+
+	SleepingObject o(5, false);
+	o.setObjectName(QString::fromLatin1("sleeper"));
+	const int id = o.startTimer(1);
+	for (int i=0; i<100 && reports.isEmpty(); ++i) {
+		d->processEvents(QEventLoop::WaitForMoreEvents);
+	}
+
+	o.killTimer(id);
+
+	QCOMPARE(reports.size(), 1);
+	QCOMPARE(int(reports.at(0).kind), int(EventDispatcherEPoll::SlowHandlerReport::Timer));
+	QCOMPARE(reports.at(0).id, id);
+	QVERIFY(0 == strcmp(reports.at(0).className, "QObject"));
+	QCOMPARE(reports.at(0).objectName, QString::fromLatin1("sleeper"));
+	QVERIFY(reports.at(0).duration > 2000);
+}
+
+void tst_EventDispatcherEPoll::watchdogSocket(void)
+{
+	ThreadDispatcher d;
+	QList<EventDispatcherEPoll::SlowHandlerReport> reports;
+	d->setSlowHandlerWatchdog(2000, logSlowHandler, &reports);
+
+	int slow[2];
+	int fast[2];
+	QVERIFY(makeSocketPair(slow));
+	QVERIFY(makeSocketPair(fast));
+
+	SleepingNotifier* sleeper = new SleepingNotifier(slow[0], 5, false);
+	sleeper->setObjectName(QString::fromLatin1("sleeper"));
+	ReadNotifier* reader = new ReadNotifier(fast[0]);
+	QCOMPARE(write(slow[1], "x", 1), ssize_t(1));
+	QCOMPARE(write(fast[1], "x", 1), ssize_t(1));
+
+	d->processEvents(QEventLoop::AllEvents);
+
+	// The handler that has kept within the budget is not reported
+	QCOMPARE(reader->activations, 1);
+	QCOMPARE(reports.size(), 1);
+	QCOMPARE(int(reports.at(0).kind), int(EventDispatcherEPoll::SlowHandlerReport::SocketRead));
+	QCOMPARE(reports.at(0).id, slow[0]);
+	QVERIFY(0 == strcmp(reports.at(0).className, "QSocketNotifier"));
+	QCOMPARE(reports.at(0).objectName, QString::fromLatin1("sleeper"));
+	QVERIFY(reports.at(0).duration > 2000);
+
+	delete sleeper;
+	delete reader;
+	close(slow[0]);
+	close(slow[1]);
+	close(fast[0]);
+	close(fast[1]);
+}
+
+void tst_EventDispatcherEPoll::watchdogReceiverDeleted(void)
+{
+	// The reports are made of what has been captured before the handlers deleted their receivers
+	ThreadDispatcher d;
+	QList<EventDispatcherEPoll::SlowHandlerReport> reports;
+	d->setSlowHandlerWatchdog(2000, logSlowHandler, &reports);
+
+	SleepingObject* o = new SleepingObject(5, true);
+	o->setObjectName(QString::fromLatin1("timer"));
+	const int id = o->startTimer(1);
+
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+	SleepingNotifier* n = new SleepingNotifier(fds[0], 5, true);
+	n->setObjectName(QString::fromLatin1("notifier"));
+	QCOMPARE(write(fds[1], "x", 1), ssize_t(1));
+
+	for (int i=0; i<100 && reports.size() < 2; ++i) {
+		d->processEvents(QEventLoop::WaitForMoreEvents);
+	}
+
+	QCOMPARE(reports.size(), 2);
+	for (int i=0; i<2; ++i) {
+		const EventDispatcherEPoll::SlowHandlerReport& r = reports.at(i);
+		QVERIFY(r.duration > 2000);
+		if (r.kind == EventDispatcherEPoll::SlowHandlerReport::Timer) {
+			QCOMPARE(r.id, id);
+			QVERIFY(0 == strcmp(r.className, "QObject"));
+			QCOMPARE(r.objectName, QString::fromLatin1("timer"));
+		}
+		else {
+			QCOMPARE(int(r.kind), int(EventDispatcherEPoll::SlowHandlerReport::SocketRead));
+			QCOMPARE(r.id, fds[0]);
+			QVERIFY(0 == strcmp(r.className, "QSocketNotifier"));
+			QCOMPARE(r.objectName, QString::fromLatin1("notifier"));
+		}
+	}
+
+	QVERIFY(reports.at(0).kind != reports.at(1).kind);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void tst_EventDispatcherEPoll::busyPollingSetting(void)
+{
+	EventDispatcherEPoll d;
+	QCOMPARE(d.busyPolling(), 0);
+
+	d.setBusyPolling(500);
+	QCOMPARE(d.busyPolling(), 500);
+
+	d.setBusyPolling(-1);
+	QCOMPARE(d.busyPolling(), 0);
+}
+
+void tst_EventDispatcherEPoll::busyPollingOff(void)
+{
+	ThreadDispatcher d;
+	QObject o;
+	QVERIFY(d->registerPreciseTimer(Q_INT64_C(5000000), &o) > 0);
+
+	d->processEvents(QEventLoop::WaitForMoreEvents);
+
+	EventDispatcherEPoll::Statistics stats = d->statistics();
+	QCOMPARE(timerEvents(stats), Q_UINT64_C(1));
+	QCOMPARE(stats.busy_poll_hits + stats.busy_poll_misses, Q_UINT64_C(0));
+}
+
+void tst_EventDispatcherEPoll::busyPollingHit(void)
+{
+	// The timer expires long before the polling budget runs out
+	ThreadDispatcher d;
+	QObject o;
+	d->setBusyPolling(1000000);
+	QVERIFY(d->registerPreciseTimer(Q_INT64_C(5000000), &o) > 0);
+
+	d->processEvents(QEventLoop::WaitForMoreEvents);
+
+	EventDispatcherEPoll::Statistics stats = d->statistics();
+	QCOMPARE(timerEvents(stats), Q_UINT64_C(1));
+	QCOMPARE(stats.busy_poll_hits, Q_UINT64_C(1));
+	QCOMPARE(stats.busy_poll_misses, Q_UINT64_C(0));
+}
+
+void tst_EventDispatcherEPoll::busyPollingMiss(void)
+{
+	// Nothing happens within the polling budget: the loop blocks
+	ThreadDispatcher d;
+	QObject o;
+	d->setBusyPolling(100);
+	QVERIFY(d->registerPreciseTimer(Q_INT64_C(20000000), &o) > 0);
+
+	d->processEvents(QEventLoop::WaitForMoreEvents);
+
+	EventDispatcherEPoll::Statistics stats = d->statistics();
+	QCOMPARE(timerEvents(stats), Q_UINT64_C(1));
+	QCOMPARE(stats.busy_poll_hits, Q_UINT64_C(0));
+	QCOMPARE(stats.busy_poll_misses, Q_UINT64_C(1));
+}
+
+void tst_EventDispatcherEPoll::busyPollingWakeUp(void)
+{
+#if QT_VERSION >= 0x040400
+	// A wakeUp() request ends polling and the loop returns without blocking, which is a hit rather than a miss
+	ThreadDispatcher d;
+	d->setBusyPolling(1000000);
+
+	WakingThread thread(threadDispatcher());
+	thread.start();
+	d->processEvents(QEventLoop::WaitForMoreEvents);
+	thread.wait();
+
+	EventDispatcherEPoll::Statistics stats = d->statistics();
+	QCOMPARE(stats.busy_poll_hits, Q_UINT64_C(1));
+	QCOMPARE(stats.busy_poll_misses, Q_UINT64_C(0));
+	QVERIFY(stats.busy_poll_time < Q_UINT64_C(1000000));
+#endif
+}
+
+void tst_EventDispatcherEPoll::dispatchBudgetRoundRobin(void)
+{
+	ThreadDispatcher d;
+	d->setDispatchBudget(1);
+
+	int fds[4][2];
+	ReadNotifier* notifiers[4];
+	for (int i=0; i<4; ++i) {
+		QVERIFY(makeSocketPair(fds[i]));
+		notifiers[i] = new ReadNotifier(fds[i][0]);
+		QCOMPARE(write(fds[i][1], "x", 1), ssize_t(1));
+	}
+
+	// One activation per iteration; the descriptors that did not fit are carried over until each has been served once
+	for (int n=1; n<=4; ++n) {
+		d->processEvents(QEventLoop::AllEvents);
+
+		int total = 0;
+		for (int i=0; i<4; ++i) {
+			QVERIFY(notifiers[i]->activations <= 1);
+			total += notifiers[i]->activations;
+		}
+
+		QCOMPARE(total, n);
+	}
+
+	QCOMPARE(d->statistics().read_events, Q_UINT64_C(4));
+
+	for (int i=0; i<4; ++i) {
+		delete notifiers[i];
+		close(fds[i][0]);
+		close(fds[i][1]);
+	}
+}
+
+void tst_EventDispatcherEPoll::dispatchBudgetDescriptorReuse(void)
+{
+	ThreadDispatcher d;
+	d->setDispatchBudget(1);
+
+	int a[2];
+	int b[2];
+	QVERIFY(makeSocketPair(a));
+	QVERIFY(makeSocketPair(b));
+
+	ReadNotifier* na = new ReadNotifier(a[0]);
+	ReadNotifier* nb = new ReadNotifier(b[0]);
+	QCOMPARE(write(a[1], "x", 1), ssize_t(1));
+	QCOMPARE(write(b[1], "x", 1), ssize_t(1));
+
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(na->activations + nb->activations, 1);
+
+	// The descriptor left in the ready queue gets closed, and its number is reused for a connection with nothing to read
+	ReadNotifier* served = na->activations ? na : nb;
+	int* queued          = (served == na) ? b : a;
+	int* other           = (served == na) ? a : b;
+	delete (served == na ? nb : na);
+
+	int c[2];
+	QVERIFY(makeSocketPair(c));
+	QCOMPARE(dup2(c[0], queued[0]), queued[0]);
+	close(c[0]);
+	close(queued[1]);
+
+	// The queued entry belongs to the closed connection and must not activate the new notifier
+	ReadNotifier* fresh = new ReadNotifier(queued[0]);
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(fresh->activations, 0);
+
+	QCOMPARE(write(c[1], "x", 1), ssize_t(1));
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(fresh->activations, 1);
+	QCOMPARE(served->activations, 1);
+
+	delete fresh;
+	delete served;
+	close(queued[0]);
+	close(other[0]);
+	close(other[1]);
+	close(c[1]);
+}
+
+void tst_EventDispatcherEPoll::dispatchBudgetNotifierReplaced(void)
+{
+	ThreadDispatcher d;
+	d->setDispatchBudget(1);
+
+	int a[2];
+	int b[2];
+	QVERIFY(makeSocketPair(a));
+	QVERIFY(makeSocketPair(b));
+
+	// The exception notifiers are never activated; they keep the handles alive when the read notifiers are gone
+	QSocketNotifier* xa = new QSocketNotifier(a[0], QSocketNotifier::Exception);
+	QSocketNotifier* xb = new QSocketNotifier(b[0], QSocketNotifier::Exception);
+	ReadNotifier* na    = new ReadNotifier(a[0]);
+	ReadNotifier* nb    = new ReadNotifier(b[0]);
+	QCOMPARE(write(a[1], "x", 1), ssize_t(1));
+	QCOMPARE(write(b[1], "x", 1), ssize_t(1));
+
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(na->activations + nb->activations, 1);
+
+	// The read notifier of the descriptor still in the ready queue is replaced after the data has been read
+	ReadNotifier* served = na->activations ? na : nb;
+	int* queued          = (served == na) ? b : a;
+	int* other           = (served == na) ? a : b;
+	delete (served == na ? nb : na);
+	drain(queued[0]);
+
+	ReadNotifier* fresh = new ReadNotifier(queued[0]);
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(fresh->activations, 0);
+
+	QCOMPARE(write(queued[1], "x", 1), ssize_t(1));
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(fresh->activations, 1);
+
+	delete fresh;
+	delete served;
+	delete xa;
+	delete xb;
+	close(queued[0]);
+	close(queued[1]);
+	close(other[0]);
+	close(other[1]);
+}
+
+void tst_EventDispatcherEPoll::descriptorReusedInBatch(void)
+{
+	// No dispatch budget: both descriptors are reported by the same epoll_wait(), and the first handler closes
+	// the other descriptor and reuses its number before the event left for it in the batch is dispatched
+	ThreadDispatcher d;
+
+	int a[2];
+	int b[2];
+	QVERIFY(makeSocketPair(a));
+	QVERIFY(makeSocketPair(b));
+
+	ReplacingNotifier* served = 0;
+	ReplacingNotifier* na     = new ReplacingNotifier(a[0], &served);
+	ReplacingNotifier* nb     = new ReplacingNotifier(b[0], &served);
+	na->partner = nb;
+	nb->partner = na;
+	QCOMPARE(write(a[1], "x", 1), ssize_t(1));
+	QCOMPARE(write(b[1], "x", 1), ssize_t(1));
+
+	d->processEvents(QEventLoop::AllEvents);
+
+	QVERIFY(served != 0);
+	int* replaced = (served == na) ? b : a;
+	int* other    = (served == na) ? a : b;
+	QCOMPARE(served->activations, 1);
+	QVERIFY(served->fresh != 0);
+	QCOMPARE(static_cast<int>(served->fresh->socket()), replaced[0]);
+
+	// The stale event has not reached the notifier of the new connection, which has nothing to read
+	QCOMPARE(served->fresh->activations, 0);
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(served->fresh->activations, 0);
+
+	QCOMPARE(write(served->peer, "x", 1), ssize_t(1));
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(served->fresh->activations, 1);
+
+	delete served->fresh;
+	close(served->peer);
+	delete served;
+	close(replaced[0]);
+	close(replaced[1]);
+	close(other[0]);
+	close(other[1]);
+}
+
+void tst_EventDispatcherEPoll::notifierToggleCancelled(void)
+{
+	ThreadDispatcher d;
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+
+	QSocketNotifier r(fds[0], QSocketNotifier::Read);
+	QSocketNotifier w(fds[0], QSocketNotifier::Write);
+	d->processEvents(QEventLoop::AllEvents);
+
+	EventDispatcherEPoll::Statistics before = d->statistics();
+	QCOMPARE(before.epoll_ctl_add, Q_UINT64_C(1));
+
+	// Either notifier keeps the descriptor registered, so toggling the other one back and forth cancels out
+	r.setEnabled(false);
+	r.setEnabled(true);
+	w.setEnabled(false);
+	w.setEnabled(true);
+	d->processEvents(QEventLoop::AllEvents);
+
+	EventDispatcherEPoll::Statistics after = d->statistics();
+	QCOMPARE(after.epoll_ctl_add, before.epoll_ctl_add);
+	QCOMPARE(after.epoll_ctl_mod, before.epoll_ctl_mod);
+	QCOMPARE(after.epoll_ctl_del, before.epoll_ctl_del);
+
+	r.setEnabled(false);
+	w.setEnabled(false);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void tst_EventDispatcherEPoll::edgeTriggeredOnce(void)
+{
+	ThreadDispatcher d;
+	d->setEdgeTriggered(true);
+
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+	CountingNotifier n(fds[0], QSocketNotifier::Read);
+	QCOMPARE(write(fds[1], "x", 1), ssize_t(1));
+
+	// The data is never read, but the descriptor has become ready only once
+	for (int i=0; i<3; ++i) {
+		d->processEvents(QEventLoop::AllEvents);
+	}
+
+	QVERIFY(registeredEvents(fds[0]) & EPOLLET);
+	QCOMPARE(n.activations, 1);
+
+	// More data is another edge
+	QCOMPARE(write(fds[1], "x", 1), ssize_t(1));
+	d->processEvents(QEventLoop::AllEvents);
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(n.activations, 2);
+
+	n.setEnabled(false);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void tst_EventDispatcherEPoll::edgeTriggeredRearm(void)
+{
+	// The only notifier of the descriptor: re-enabling it registers the descriptor anew
+	ThreadDispatcher d;
+	d->setEdgeTriggered(true);
+
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+	CountingNotifier n(fds[0], QSocketNotifier::Read);
+	QCOMPARE(write(fds[1], "x", 1), ssize_t(1));
+	d->processEvents(QEventLoop::AllEvents);
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(n.activations, 1);
+
+	EventDispatcherEPoll::Statistics before = d->statistics();
+	n.setEnabled(false);
+	n.setEnabled(true);
+	d->processEvents(QEventLoop::AllEvents);
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(n.activations, 2);
+
+	EventDispatcherEPoll::Statistics after = d->statistics();
+	QCOMPARE(after.epoll_ctl_del, before.epoll_ctl_del + 1);
+	QCOMPARE(after.epoll_ctl_add, before.epoll_ctl_add + 1);
+	QCOMPARE(after.epoll_ctl_mod, before.epoll_ctl_mod);
+
+	n.setEnabled(false);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void tst_EventDispatcherEPoll::edgeTriggeredRearmShared(void)
+{
+	// The exception notifier keeps the descriptor registered: re-enabling the read notifier re-arms it with EPOLL_CTL_MOD,
+	// even though the interest set ends up the same
+	ThreadDispatcher d;
+	d->setEdgeTriggered(true);
+
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+	CountingNotifier x(fds[0], QSocketNotifier::Exception);
+	CountingNotifier n(fds[0], QSocketNotifier::Read);
+	QCOMPARE(write(fds[1], "x", 1), ssize_t(1));
+	d->processEvents(QEventLoop::AllEvents);
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(n.activations, 1);
+
+	EventDispatcherEPoll::Statistics before = d->statistics();
+	n.setEnabled(false);
+	n.setEnabled(true);
+	d->processEvents(QEventLoop::AllEvents);
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(n.activations, 2);
+	QCOMPARE(x.activations, 0);
+
+	EventDispatcherEPoll::Statistics after = d->statistics();
+	QCOMPARE(after.epoll_ctl_mod, before.epoll_ctl_mod + 1);
+	QCOMPARE(after.epoll_ctl_add, before.epoll_ctl_add);
+	QCOMPARE(after.epoll_ctl_del, before.epoll_ctl_del);
+
+	n.setEnabled(false);
+	x.setEnabled(false);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void tst_EventDispatcherEPoll::notifierToggleLastNotifier(void)
+{
+	ThreadDispatcher d;
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+
+	QSocketNotifier r(fds[0], QSocketNotifier::Read);
+	d->processEvents(QEventLoop::AllEvents);
+
+	EventDispatcherEPoll::Statistics before = d->statistics();
+
+	// The last notifier of a descriptor takes the registration with it
+	r.setEnabled(false);
+	r.setEnabled(true);
+	d->processEvents(QEventLoop::AllEvents);
+
+	EventDispatcherEPoll::Statistics after = d->statistics();
+	QCOMPARE(after.epoll_ctl_del, before.epoll_ctl_del + 1);
+	QCOMPARE(after.epoll_ctl_add, before.epoll_ctl_add + 1);
+	QCOMPARE(after.epoll_ctl_mod, before.epoll_ctl_mod);
+
+	r.setEnabled(false);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void tst_EventDispatcherEPoll::postRunsTasksInOrder(void)
+{
+#if QT_VERSION >= 0x040400
+	EventDispatcherEPoll d;
+	QList<int> list;
+	NumberedTask tasks[3];
+	for (int i=0; i<3; ++i) {
+		tasks[i].list   = &list;
+		tasks[i].number = i;
+		d.post(runNumberedTask, &tasks[i]);
+	}
+
+	// Tasks run from processEvents() only, and only once
+	QVERIFY(list.isEmpty());
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(list, QList<int>() << 0 << 1 << 2);
+
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(list.size(), 3);
+#endif
+}
+
+void tst_EventDispatcherEPoll::postFromAnotherThread(void)
+{
+#if QT_VERSION >= 0x040400
+	EventDispatcherEPoll d;
+	QList<int> list;
+	NumberedTask tasks[100];
+	QList<int> expected;
+	for (int i=0; i<100; ++i) {
+		tasks[i].list   = &list;
+		tasks[i].number = i;
+		expected << i;
+	}
+
+	// The posts wake the blocked loop up
+	PostingThread thread(&d, tasks, 100);
+	thread.start();
+	while (list.size() < 100) {
+		d.processEvents(QEventLoop::WaitForMoreEvents);
+	}
+
+	thread.wait();
+	QCOMPARE(list, expected);
+#endif
+}
+
+void tst_EventDispatcherEPoll::postDiscardsTasksOnDestruction(void)
+{
+#if QT_VERSION >= 0x040400
+	QList<int> list;
+	NumberedTask task = { &list, 0 };
+
+	EventDispatcherEPoll* d = new EventDispatcherEPoll;
+	d->post(runNumberedTask, &task);
+	delete d;
+	QVERIFY(list.isEmpty());
+
+#	ifdef EVENTDISPATCHER_EPOLL_CXX11
+	// The function object of a discarded task is destroyed
+	std::shared_ptr<int> counter(new int(0));
+	d = new EventDispatcherEPoll;
+	d->post([counter]() { ++*counter; });
+	QCOMPARE(counter.use_count(), long(2));
+	delete d;
+	QCOMPARE(counter.use_count(), long(1));
+	QCOMPARE(*counter, 0);
+#	endif
+#endif
+}
+
+void tst_EventDispatcherEPoll::preciseTimerSubMillisecond(void)
+{
+	ThreadDispatcher d;
+	TimerCounter o;
+	const int id = d->registerPreciseTimer(Q_INT64_C(200000), &o);
+	QVERIFY(id > 0);
+	QCOMPARE(registeredInterval(&o), 1);
+
+	const qint64 start = monotonicMsecs();
+	while (monotonicMsecs() - start < 50) {
+		d->processEvents(QEventLoop::WaitForMoreEvents);
+	}
+
+	// A millisecond timer would have fired 50 times at most
+	QVERIFY(o.fires > 60);
+
+	// An ordinary Qt timer otherwise
+	o.killTimer(id);
+	QCOMPARE(registeredInterval(&o), -1);
+
+	const int fires = o.fires;
+	QTest::qSleep(5);
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(o.fires, fires);
+}
+
+void tst_EventDispatcherEPoll::preciseTimerInvalidArguments(void)
+{
+	ThreadDispatcher d;
+	QObject o;
+	QCOMPARE(d->registerPreciseTimer(0, &o), 0);
+	QCOMPARE(d->registerPreciseTimer(-1000, &o), 0);
+	QCOMPARE(d->registerPreciseTimer(1000, 0), 0);
+
+	// A dispatcher that is not installed in the object's thread cannot start timers for it
+	EventDispatcherEPoll standalone;
+	QCOMPARE(standalone.registerPreciseTimer(Q_INT64_C(1000000), &o), 0);
+	QVERIFY(threadDispatcher()->registeredTimers(&o).isEmpty());
+}
+
+void tst_EventDispatcherEPoll::preciseTimerChrono(void)
+{
+#ifdef EVENTDISPATCHER_EPOLL_CXX11
+	ThreadDispatcher d;
+	TimerCounter o;
+	const int id = d->registerTimer(std::chrono::microseconds(1500), &o);
+	QVERIFY(id > 0);
+	QCOMPARE(registeredInterval(&o), 2);
+#	if QT_VERSION >= 0x050000
+	QCOMPARE(threadDispatcher()->registeredTimers(&o).at(0).timerType, Qt::PreciseTimer);
+#	endif
+
+	d->processEvents(QEventLoop::WaitForMoreEvents);
+	QCOMPARE(o.fires, 1);
+	o.killTimer(id);
+#endif
+}
+
+void tst_EventDispatcherEPoll::timerOverrunsCoalesced(void)
+{
+	ThreadDispatcher d;
+	TimerCounter o;
+	const int id = d->registerPreciseTimer(Q_INT64_C(1000000), &o);
+	QVERIFY(id > 0);
+
+	d->processEvents(QEventLoop::WaitForMoreEvents);
+	QCOMPARE(o.fires, 1);
+
+	// The loop falls behind by about ten intervals: the expirations arrive as one event
+	QTest::qSleep(10);
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(o.fires, 2);
+	QVERIFY(o.overruns >= 5);
+
+	// The count stays until the next event
+	QCOMPARE(d->timerOverruns(id), o.overruns);
+
+	o.killTimer(id);
+	QCOMPARE(d->timerOverruns(id), -1);
+}
+
+void tst_EventDispatcherEPoll::timerOverrunsOtherTimers(void)
+{
+	ThreadDispatcher d;
+	TimerCounter o;
+	QCOMPARE(d->timerOverruns(12345), -1);
+
+	// A coarse timer that is late just fires late
+	const int id = o.startTimer(50);
+	QVERIFY(id > 0);
+	QCOMPARE(d->timerOverruns(id), 0);
+
+	QTest::qSleep(120);
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(o.fires, 1);
+	QCOMPARE(o.overruns, 0);
+
+	o.killTimer(id);
+}
+
+void tst_EventDispatcherEPoll::timerNestedLoop(void)
+{
+	ThreadDispatcher d;
+
+	// The older timer is due later than the one whose handler runs the loop
+	{
+		TimerCounter older;
+		NestingTimer nesting(&older);
+		QVERIFY(d->registerPreciseTimer(Q_INT64_C(30000000), &older) > 0);
+		QVERIFY(d->registerPreciseTimer(Q_INT64_C(5000000), &nesting) > 0);
+
+		while (!nesting.fires) {
+			d->processEvents(QEventLoop::WaitForMoreEvents);
+		}
+
+		QCOMPARE(nesting.fires, 1);
+		QCOMPARE(nesting.nested_fires, 1);
+	}
+
+	// Both timers expire in the same batch: whichever is fired first, the other one fires in the nested loop
+	{
+		TimerCounter older;
+		NestingTimer nesting(&older);
+		QVERIFY(d->registerPreciseTimer(Q_INT64_C(5000000), &older) > 0);
+		QVERIFY(d->registerPreciseTimer(Q_INT64_C(5000000), &nesting) > 0);
+
+		QTest::qSleep(6);
+		while (!nesting.fires) {
+			d->processEvents(QEventLoop::WaitForMoreEvents);
+		}
+
+		QCOMPARE(nesting.nested_fires, 1);
+	}
+}
+
+void tst_EventDispatcherEPoll::zeroTimerUnregisterSelf(void)
+{
+	ThreadDispatcher d;
+	ZeroTimerObject a(ZeroTimerObject::Unregister);
+	ZeroTimerObject b;
+
+	d->processEvents(QEventLoop::AllEvents);
+	d->processEvents(QEventLoop::AllEvents);
+
+	QCOMPARE(a.fires, 1);
+	QCOMPARE(b.fires, 2);
+	QCOMPARE(d->poolStatistics().zero_timers, 1);
+}
+
+void tst_EventDispatcherEPoll::zeroTimerUnregisterNeighbours(void)
+{
+	// The first timer unregisters the next one before it fires, the last one unregisters the first one after it has fired
+	ThreadDispatcher d;
+	ZeroTimerObject a(ZeroTimerObject::Unregister);
+	ZeroTimerObject b;
+	ZeroTimerObject c(ZeroTimerObject::Unregister);
+	a.target = &b;
+	c.target = &a;
+
+	d->processEvents(QEventLoop::AllEvents);
+	d->processEvents(QEventLoop::AllEvents);
+
+	QCOMPARE(a.fires, 1);
+	QCOMPARE(b.fires, 0);
+	QCOMPARE(c.fires, 2);
+	QCOMPARE(d->poolStatistics().zero_timers, 1);
+}
+
+void tst_EventDispatcherEPoll::zeroTimerReregistered(void)
+{
+	// A timer registered during a pass does not fire before the next one, even if its ID has fired in this pass:
+	// the first timer registers itself again, the last one registers the one in the middle again
+	ThreadDispatcher d;
+	ZeroTimerObject a(ZeroTimerObject::Reregister);
+	ZeroTimerObject b;
+	ZeroTimerObject c(ZeroTimerObject::Reregister);
+	c.target = &b;
+
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(a.fires, 1);
+	QCOMPARE(b.fires, 1);
+	QCOMPARE(c.fires, 1);
+
+	// Registered anew, the timers keep firing once per pass
+	c.action = ZeroTimerObject::Nothing;
+	for (int i=2; i<=3; ++i) {
+		d->processEvents(QEventLoop::AllEvents);
+		QCOMPARE(a.fires, i);
+		QCOMPARE(b.fires, i);
+		QCOMPARE(c.fires, i);
+	}
+
+	QCOMPARE(d->poolStatistics().zero_timers, 3);
+}
+
+void tst_EventDispatcherEPoll::zeroTimerNestedLoop(void)
+{
+	// The nested loop is an iteration of its own: it fires the timer before the nesting one again,
+	// and fires the one after it in place of the outer loop, which must not fire it again
+	ThreadDispatcher d;
+	ZeroTimerObject before;
+	ZeroTimerObject nesting(ZeroTimerObject::Nest);
+	ZeroTimerObject after;
+
+	d->processEvents(QEventLoop::AllEvents);
+
+	QCOMPARE(before.fires, 2);
+	QCOMPARE(nesting.fires, 1);
+	QCOMPARE(after.fires, 1);
+	QCOMPARE(timerEvents(d->statistics()) + d->statistics().zero_timer_events, Q_UINT64_C(4));
+
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(before.fires, 3);
+	QCOMPARE(nesting.fires, 2);
+	QCOMPARE(after.fires, 2);
+}
+
+void tst_EventDispatcherEPoll::signalWatch(void)
+{
+	EventDispatcherEPoll d;
+	SignalLog log;
+	QVERIFY(d.watchSignal(SIGUSR1, logSignal, &log));
+
+	// The signal is blocked and goes to the signalfd instead
+	sigset_t mask;
+	pthread_sigmask(SIG_BLOCK, 0, &mask);
+	QVERIFY(sigismember(&mask, SIGUSR1));
+
+	raiseSignal(SIGUSR1);
+	QVERIFY(log.signos.isEmpty());
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(log.signos, QList<int>() << SIGUSR1);
+
+	d.unwatchSignal(SIGUSR1);
+}
+
+void tst_EventDispatcherEPoll::signalReplace(void)
+{
+	EventDispatcherEPoll d;
+	SignalLog first;
+	SignalLog second;
+	QVERIFY(d.watchSignal(SIGUSR1, logSignal, &first));
+	QVERIFY(d.watchSignal(SIGUSR1, logSignal, &second));
+
+	raiseSignal(SIGUSR1);
+	d.processEvents(QEventLoop::AllEvents);
+	QVERIFY(first.signos.isEmpty());
+	QCOMPARE(second.signos, QList<int>() << SIGUSR1);
+
+	d.unwatchSignal(SIGUSR1);
+}
+
+void tst_EventDispatcherEPoll::signalUnwatch(void)
+{
+	EventDispatcherEPoll d;
+	SignalLog usr1;
+	SignalLog usr2;
+	QVERIFY(d.watchSignal(SIGUSR1, logSignal, &usr1));
+	QVERIFY(d.watchSignal(SIGUSR2, logSignal, &usr2));
+	d.unwatchSignal(SIGUSR1);
+
+	// The other signal is still watched; the unwatched one stays blocked and pending
+	raiseSignal(SIGUSR1);
+	raiseSignal(SIGUSR2);
+	d.processEvents(QEventLoop::AllEvents);
+	QVERIFY(usr1.signos.isEmpty());
+	QCOMPARE(usr2.signos, QList<int>() << SIGUSR2);
+	QVERIFY(takePendingSignal(SIGUSR1));
+
+	// Unwatching the last signal leaves nothing to deliver
+	d.unwatchSignal(SIGUSR2);
+	raiseSignal(SIGUSR2);
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(usr2.signos.size(), 1);
+	QVERIFY(takePendingSignal(SIGUSR2));
+
+	// Unwatching a signal that is not watched changes nothing
+	d.unwatchSignal(SIGUSR2);
+}
+
+void tst_EventDispatcherEPoll::signalRejected(void)
+{
+	EventDispatcherEPoll d;
+	SignalLog log;
+	QVERIFY(!d.watchSignal(SIGKILL, logSignal, &log));
+	QVERIFY(!d.watchSignal(SIGSTOP, logSignal, &log));
+	QVERIFY(!d.watchSignal(0, logSignal, &log));
+	QVERIFY(!d.watchSignal(_NSIG, logSignal, &log));
+}
+
+void tst_EventDispatcherEPoll::signalBatch(void)
+{
+	EventDispatcherEPoll d;
+	SignalLog log;
+	QVERIFY(d.watchSignal(SIGRTMIN, logSignal, &log));
+
+	// Real-time signals are queued rather than merged, and everything queued is delivered in one go, in order
+	QList<int> expected;
+	for (int i=0; i<40; ++i) {
+		union sigval value;
+		value.sival_int = i;
+		QCOMPARE(pthread_sigqueue(pthread_self(), SIGRTMIN, value), 0);
+		expected << i;
+	}
+
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(log.values, expected);
+
+	d.unwatchSignal(SIGRTMIN);
+}
+
+void tst_EventDispatcherEPoll::signalFunction(void)
+{
+#ifdef EVENTDISPATCHER_EPOLL_CXX11
+	EventDispatcherEPoll d;
+	std::shared_ptr<int> counter(new int(0));
+
+	// The handler may unwatch its own signal; the function object is released afterwards
+	QVERIFY(d.watchSignal(SIGUSR1, [&d, counter](const struct signalfd_siginfo&) {
+		++*counter;
+		d.unwatchSignal(SIGUSR1);
+	}));
+
+	QCOMPARE(counter.use_count(), long(2));
+	raiseSignal(SIGUSR1);
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(*counter, 1);
+	QCOMPARE(counter.use_count(), long(1));
+#endif
+}
+
+void tst_EventDispatcherEPoll::watcherCallback(void)
+{
+	EventDispatcherEPoll d;
+	d.setStatisticsEnabled(true);
+
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+
+	DescriptorLog log;
+	QVERIFY(d.watchDescriptor(fds[0], EPOLLIN, logDescriptor, &log));
+	d.processEvents(QEventLoop::AllEvents);
+	QVERIFY(log.events.isEmpty());
+
+	// Level-triggered: called on every iteration until the data is read
+	QCOMPARE(write(fds[1], "x", 1), ssize_t(1));
+	d.processEvents(QEventLoop::AllEvents);
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(log.fds, QList<int>() << fds[0] << fds[0]);
+	QCOMPARE(log.events, QList<uint>() << uint(EPOLLIN) << uint(EPOLLIN));
+	QCOMPARE(d.statistics().descriptor_events, Q_UINT64_C(2));
+
+	drain(fds[0]);
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(log.events.size(), 2);
+
+	d.unwatchDescriptor(fds[0]);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void tst_EventDispatcherEPoll::watcherInterestSet(void)
+{
+	EventDispatcherEPoll d;
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+
+	DescriptorLog log;
+	QVERIFY(!d.watchDescriptor(fds[0], EPOLLIN | (1u << 20), logDescriptor, &log));
+	QVERIFY(!d.watchDescriptor(-1, EPOLLIN, logDescriptor, &log));
+	QVERIFY(!d.setDescriptorEvents(fds[0], EPOLLIN));
+
+	// An empty interest set suspends the watcher
+	QVERIFY(d.watchDescriptor(fds[0], EPOLLIN, logDescriptor, &log));
+	QVERIFY(d.setDescriptorEvents(fds[0], 0));
+	QCOMPARE(write(fds[1], "x", 1), ssize_t(1));
+	d.processEvents(QEventLoop::AllEvents);
+	QVERIFY(log.events.isEmpty());
+
+	QVERIFY(!d.setDescriptorEvents(fds[0], EPOLLIN | (1u << 20)));
+	QVERIFY(d.setDescriptorEvents(fds[0], EPOLLIN));
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(log.events, QList<uint>() << uint(EPOLLIN));
+
+	d.unwatchDescriptor(fds[0]);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void tst_EventDispatcherEPoll::watcherReplace(void)
+{
+	EventDispatcherEPoll d;
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+
+	// Both the interest set and the callback are replaced
+	DescriptorLog first;
+	DescriptorLog second;
+	QVERIFY(d.watchDescriptor(fds[0], EPOLLIN, logDescriptor, &first));
+	QVERIFY(d.watchDescriptor(fds[0], EPOLLOUT, logDescriptor, &second));
+
+	d.processEvents(QEventLoop::AllEvents);
+	QVERIFY(first.events.isEmpty());
+	QCOMPARE(second.events, QList<uint>() << uint(EPOLLOUT));
+
+	d.unwatchDescriptor(fds[0]);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void tst_EventDispatcherEPoll::watcherHangup(void)
+{
+	EventDispatcherEPoll d;
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+
+	DescriptorLog log;
+	QVERIFY(d.watchDescriptor(fds[0], EPOLLRDHUP, logDescriptor, &log));
+	close(fds[1]);
+
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(log.events.size(), 1);
+	QVERIFY(log.events.at(0) & EPOLLRDHUP);
+	d.unwatchDescriptor(fds[0]);
+	close(fds[0]);
+
+	// EPOLLHUP is reported even with an empty interest set
+	int other[2];
+	QVERIFY(makeSocketPair(other));
+	QVERIFY(d.watchDescriptor(other[0], 0, logDescriptor, &log));
+	shutdown(other[1], SHUT_RDWR);
+
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(log.events.size(), 2);
+	QCOMPARE(log.fds.at(1), other[0]);
+	QVERIFY(log.events.at(1) & EPOLLHUP);
+
+	d.unwatchDescriptor(other[0]);
+	close(other[0]);
+	close(other[1]);
+}
+
+void tst_EventDispatcherEPoll::watcherOneShot(void)
+{
+	EventDispatcherEPoll d;
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+
+	DescriptorLog log;
+	QVERIFY(d.watchDescriptor(fds[0], EPOLLIN | EPOLLONESHOT, logDescriptor, &log));
+	QCOMPARE(write(fds[1], "x", 1), ssize_t(1));
+
+	d.processEvents(QEventLoop::AllEvents);
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(log.events.size(), 1);
+
+	// Setting the same interest set again re-arms the watcher
+	QVERIFY(d.setDescriptorEvents(fds[0], EPOLLIN | EPOLLONESHOT));
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(log.events.size(), 2);
+
+	d.unwatchDescriptor(fds[0]);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void tst_EventDispatcherEPoll::watcherUnwatch(void)
+{
+	EventDispatcherEPoll d;
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+
+	DescriptorLog log;
+	QVERIFY(d.watchDescriptor(fds[0], EPOLLIN, logDescriptor, &log));
+	d.unwatchDescriptor(fds[0]);
+
+	QCOMPARE(write(fds[1], "x", 1), ssize_t(1));
+	d.processEvents(QEventLoop::AllEvents);
+	QVERIFY(log.events.isEmpty());
+	QVERIFY(!d.setDescriptorEvents(fds[0], EPOLLIN));
+
+	// Unwatching a descriptor that is not watched changes nothing
+	d.unwatchDescriptor(fds[0]);
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void tst_EventDispatcherEPoll::watcherExcludesNotifiers(void)
+{
+	// Socket notifiers go to the thread's dispatcher
+	ThreadDispatcher d;
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+
+	DescriptorLog log;
+	QVERIFY(d->watchDescriptor(fds[0], EPOLLIN, logDescriptor, &log));
+
+	// The notifier is refused; the watcher is not affected
+	ReadNotifier* notifier = new ReadNotifier(fds[0]);
+	QCOMPARE(write(fds[1], "x", 1), ssize_t(1));
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(notifier->activations, 0);
+	QCOMPARE(log.events.size(), 1);
+
+	delete notifier;
+	d->unwatchDescriptor(fds[0]);
+
+	// And the other way round
+	notifier = new ReadNotifier(fds[0]);
+	QVERIFY(!d->watchDescriptor(fds[0], EPOLLIN, logDescriptor, &log));
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(notifier->activations, 1);
+	QCOMPARE(log.events.size(), 1);
+
+	delete notifier;
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void tst_EventDispatcherEPoll::watcherFunction(void)
+{
+#ifdef EVENTDISPATCHER_EPOLL_CXX11
+	EventDispatcherEPoll d;
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+
+	std::shared_ptr<int> counter(new int(0));
+	QVERIFY(d.watchDescriptor(fds[0], EPOLLOUT, [counter](int, uint) { ++*counter; }));
+	QCOMPARE(counter.use_count(), long(2));
+
+	// The handler may unwatch its own descriptor; the function object is released afterwards
+	QVERIFY(d.watchDescriptor(fds[0], EPOLLOUT, [&d, counter](int fd, uint) {
+		*counter += 10;
+		d.unwatchDescriptor(fd);
+	}));
+
+	QCOMPARE(counter.use_count(), long(2));
+	d.processEvents(QEventLoop::AllEvents);
+	d.processEvents(QEventLoop::AllEvents);
+	QCOMPARE(*counter, 10);
+	QCOMPARE(counter.use_count(), long(1));
+
+	close(fds[0]);
+	close(fds[1]);
+#endif
+}
+
+void tst_EventDispatcherEPoll::groupMembership(void)
+{
+	EventDispatcherEPollGroup group;
+	EventDispatcherEPollGroup other;
+	EventDispatcherEPoll* first  = new EventDispatcherEPoll;
+	EventDispatcherEPoll* second = new EventDispatcherEPoll;
+
+	group.addDispatcher(first);
+	group.addDispatcher(second);
+	QCOMPARE(group.dispatchers(), QList<EventDispatcherEPoll*>() << first << second);
+
+	// A dispatcher belongs to one group at a time
+	other.addDispatcher(first);
+	QVERIFY(other.dispatchers().isEmpty());
+
+	group.removeDispatcher(first);
+	QCOMPARE(group.dispatchers(), QList<EventDispatcherEPoll*>() << second);
+	other.addDispatcher(first);
+	QCOMPARE(other.dispatchers(), QList<EventDispatcherEPoll*>() << first);
+
+	// A dispatcher leaves its group when it is destroyed
+	delete second;
+	QVERIFY(group.dispatchers().isEmpty());
+	delete first;
+	QVERIFY(other.dispatchers().isEmpty());
+
+	group.addSharedDescriptor(7);
+	group.addSharedDescriptor(3);
+	QVERIFY(group.isSharedDescriptor(7));
+	QVERIFY(group.isSharedDescriptor(3));
+	QVERIFY(!group.isSharedDescriptor(5));
+	group.removeSharedDescriptor(7);
+	QVERIFY(!group.isSharedDescriptor(7));
+}
+
+void tst_EventDispatcherEPoll::groupSharedDescriptor(void)
+{
+	// Socket notifiers go to the thread's dispatcher
+	ThreadDispatcher d;
+	EventDispatcherEPollGroup group;
+	group.addDispatcher(threadDispatcher());
+
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+
+	group.addSharedDescriptor(fds[0]);
+	ReadNotifier* notifier = new ReadNotifier(fds[0]);
+	d->processEvents(QEventLoop::AllEvents);
+	QVERIFY(registeredEvents(fds[0]) & EPOLLEXCLUSIVE);
+
+	// Notifiers that are already registered follow the changes of the set
+	group.removeSharedDescriptor(fds[0]);
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(registeredEvents(fds[0]) & (EPOLLIN | EPOLLEXCLUSIVE), uint(EPOLLIN));
+
+	group.addSharedDescriptor(fds[0]);
+	d->processEvents(QEventLoop::AllEvents);
+	QVERIFY(registeredEvents(fds[0]) & EPOLLEXCLUSIVE);
+
+	// The notifier still works
+	QCOMPARE(write(fds[1], "x", 1), ssize_t(1));
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(notifier->activations, 1);
+
+	// EPOLLEXCLUSIVE does not support EPOLLPRI
+	QSocketNotifier* exception = new QSocketNotifier(fds[0], QSocketNotifier::Exception);
+	d->processEvents(QEventLoop::AllEvents);
+	QCOMPARE(registeredEvents(fds[0]) & (EPOLLIN | EPOLLPRI | EPOLLEXCLUSIVE), uint(EPOLLIN | EPOLLPRI));
+
+	delete exception;
+	delete notifier;
+	group.removeDispatcher(threadDispatcher());
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void tst_EventDispatcherEPoll::groupUpdateWhileRunning(void)
+{
+	ThreadDispatcher d;
+	EventDispatcherEPollGroup group;
+	group.addDispatcher(threadDispatcher());
+
+	int fds[2];
+	QVERIFY(makeSocketPair(fds));
+
+	// The set changes while the member registers notifiers and runs its event loop
+	SharingThread thread(&group, fds[0]);
+	thread.start();
+	for (int i=0; i<100; ++i) {
+		ReadNotifier notifier(fds[0]);
+		d->processEvents(QEventLoop::AllEvents);
+	}
+
+	thread.wait();
+
+	ReadNotifier* notifier = new ReadNotifier(fds[0]);
+	d->processEvents(QEventLoop::AllEvents);
+	QVERIFY(registeredEvents(fds[0]) & EPOLLEXCLUSIVE);
+
+	group.removeDispatcher(threadDispatcher());
+	d->processEvents(QEventLoop::AllEvents);
+	QVERIFY(!(registeredEvents(fds[0]) & EPOLLEXCLUSIVE));
+
+	delete notifier;
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main(int argc, char** argv)
+{
+#if QT_VERSION >= 0x050000
+	QCoreApplication::setEventDispatcher(new EventDispatcherEPoll);
+#else
+	EventDispatcherEPoll dispatcher;
+#endif
+	QCoreApplication app(argc, argv);
+	tst_EventDispatcherEPoll test;
+	return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_eventdispatcher_epoll.moc"
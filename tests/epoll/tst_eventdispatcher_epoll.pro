@@ -0,0 +1,10 @@
+QT      -= gui
+QT      += testlib
+CONFIG  += console testcase
+CONFIG  -= app_bundle
+TEMPLATE = app
+TARGET   = tst_eventdispatcher_epoll
+SOURCES  = tst_eventdispatcher_epoll.cpp
+DESTDIR  = ..
+
+include(../local.pri)
@@ -1,12 +1,18 @@
 #ifndef EVENTDISPATCHER_H
 #define EVENTDISPATCHER_H
 
-#include "eventdispatcher_epoll.h"
+#ifdef EVENTDISPATCHER_IOURING
+#	include "eventdispatcher_iouring.h"
+typedef EventDispatcherIOUring EventDispatcherBase;
+#else
+#	include "eventdispatcher_epoll.h"
+typedef EventDispatcherEPoll EventDispatcherBase;
+#endif
 
-class EventDispatcher : public EventDispatcherEPoll {
+class EventDispatcher : public EventDispatcherBase {
 	Q_OBJECT
 public:
-	explicit EventDispatcher(QObject* parent = 0) : EventDispatcherEPoll(parent) {}
+	explicit EventDispatcher(QObject* parent = 0) : EventDispatcherBase(parent) {}
 };
 
 #endif // EVENTDISPATCHER_H
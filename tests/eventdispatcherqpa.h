@@ -1,12 +1,18 @@
 #ifndef EVENTDISPATCHERQPA_H
 #define EVENTDISPATCHERQPA_H
 
-#include "eventdispatcher_epoll_qpa.h"
+#ifdef EVENTDISPATCHER_IOURING
+#	include "eventdispatcher_iouring_qpa.h"
+typedef EventDispatcherIOUringQPA EventDispatcherQPABase;
+#else
+#	include "eventdispatcher_epoll_qpa.h"
+typedef EventDispatcherEPollQPA EventDispatcherQPABase;
+#endif
 
-class EventDispatcherQPA : public EventDispatcherEPollQPA {
+class EventDispatcherQPA : public EventDispatcherQPABase {
 	Q_OBJECT
 public:
-	explicit EventDispatcherQPA(QObject* parent = 0) : EventDispatcherEPollQPA(parent) {}
+	explicit EventDispatcherQPA(QObject* parent = 0) : EventDispatcherQPABase(parent) {}
 };
 
 #endif // EVENTDISPATCHERQPA_H
@@ -3,6 +3,9 @@ DEPENDPATH  += $$PWD $$PWD/../src
 
 HEADERS += $$PWD/eventdispatcher.h
 
+# qmake CONFIG+=iouring runs the tests against EventDispatcherIOUring
+CONFIG(iouring): DEFINES += EVENTDISPATCHER_IOURING
+
 CONFIG  *= link_prl
 LIBS    += -L$$OUT_PWD/$$DESTDIR/../lib
 